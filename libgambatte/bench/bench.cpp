@@ -0,0 +1,175 @@
+// gambatte_bench: runs a ROM for a fixed number of frames, without video or
+// sound output, and prints how long that took.
+//
+//   gambatte_bench ROM [frames] [-r runs] [-b breakpoints] [-c coverage]
+//                  [-s full|delta]
+//
+// Every run starts from the state right after loading, so runs are
+// identical and the best one is the least disturbed by the host. Breakpoints
+// are set at 0x8000 upwards, in VRAM and cartridge RAM, where they add
+// lookups without being hit; a ROM that runs code from there would stop at
+// one and never finish. -c sets an edge coverage bitmap of that many bytes.
+// -s saves a full or a delta state after every frame; the time spent saving
+// is included in the run and also reported on its own.
+
+#include "gambatte.h"
+#include "debugger/Breakpoint.h"
+#include "easylogging++.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+INITIALIZE_EASYLOGGINGPP
+
+using namespace gambatte;
+
+namespace {
+
+double const gbFps = 4194304.0 / 70224;
+
+// The choice cpu.cpp makes; this file is built with the library's flags.
+#if defined(__GNUC__) && !defined(GAMBATTE_NO_THREADED_DISPATCH)
+char const dispatch[] = "threaded";
+#else
+char const dispatch[] = "switch";
+#endif
+
+void usage() {
+	std::fprintf(stderr, "usage: gambatte_bench ROM [frames] [-r runs] [-b breakpoints] [-c coverage]\n"
+	                     "                      [-s full|delta]\n");
+	std::exit(1);
+}
+
+enum StateMode { no_states, full_states, delta_states };
+
+struct StateStats {
+	double seconds;
+	unsigned long long bytes;
+};
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+double runFrames(GB &gb, std::vector<char> const &initial, int frames,
+                 StateMode states, StateStats &stats) {
+	static video_pixel_t videoBuf[160 * 144];
+	static uint_least32_t soundBuf[35112 + 2064];
+	std::vector<char> state;
+
+	// Also the base of the first delta.
+	gb.loadState(&initial[0]);
+	stats.seconds = 0;
+	stats.bytes = 0;
+
+	std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+	for (int frame = 0; frame < frames;) {
+		unsigned samples = 35112;
+		if (gb.runFor(videoBuf, 160, soundBuf, samples) < 0)
+			continue;
+
+		++frame;
+		if (states != no_states) {
+			std::chrono::steady_clock::time_point const saveStart = std::chrono::steady_clock::now();
+			std::size_t const size = states == full_states ? gb.stateSize() : gb.deltaStateSize();
+			state.resize(size);
+			if (states == full_states)
+				gb.saveState(&state[0]);
+			else
+				gb.saveDeltaState(&state[0]);
+
+			stats.seconds += secondsSince(saveStart);
+			stats.bytes += size;
+		}
+	}
+
+	return secondsSince(start);
+}
+
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		usage();
+
+	char const *romPath = argv[1];
+	int frames = 600;
+	int runs = 3;
+	long breakpoints = 0;
+	unsigned long coverage = 0;
+	StateMode states = no_states;
+
+	for (int i = 2; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-r") && i + 1 < argc)
+			runs = std::atoi(argv[++i]);
+		else if (!std::strcmp(argv[i], "-b") && i + 1 < argc)
+			breakpoints = std::atol(argv[++i]);
+		else if (!std::strcmp(argv[i], "-c") && i + 1 < argc)
+			coverage = std::strtoul(argv[++i], 0, 0);
+		else if (!std::strcmp(argv[i], "-s") && i + 1 < argc && !std::strcmp(argv[i + 1], "full"))
+			states = full_states, ++i;
+		else if (!std::strcmp(argv[i], "-s") && i + 1 < argc && !std::strcmp(argv[i + 1], "delta"))
+			states = delta_states, ++i;
+		else if (argv[i][0] != '-')
+			frames = std::atoi(argv[i]);
+		else
+			usage();
+	}
+
+	if (frames <= 0 || runs <= 0 || breakpoints < 0 || breakpoints > 0x4000)
+		usage();
+
+	std::ifstream file(romPath, std::ios::binary);
+	std::vector<char> const rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (rom.empty()) {
+		std::fprintf(stderr, "could not read %s\n", romPath);
+		return 1;
+	}
+
+	GB gb;
+	if (gb.load(&rom[0], rom.size())) {
+		std::fprintf(stderr, "could not load %s\n", romPath);
+		return 1;
+	}
+
+	if (!gb.setCoverage(coverage)) {
+		std::fprintf(stderr, "coverage size must be a power of two\n");
+		return 1;
+	}
+
+	std::vector<char> start(gb.stateSize());
+	gb.saveState(&start[0]);
+
+	for (long i = 0; i < breakpoints; ++i) {
+		long const address = 0x8000 + i;
+		gb.debugger->Execute([&gb, address] {
+			gb.debugger->AddBreakpoint(new debugger::Breakpoint(address));
+		});
+	}
+
+	static char const *const stateNames[] = { "no", "full", "delta" };
+	std::printf("%s: %d frames, %s dispatch, %ld breakpoints, coverage %lu, %s states\n",
+	            romPath, frames, dispatch, breakpoints, coverage, stateNames[states]);
+
+	double best = 0;
+	for (int run = 1; run <= runs; ++run) {
+		StateStats stats;
+		double const seconds = runFrames(gb, start, frames, states, stats);
+		std::printf("run %d: %.3f s, %.1f fps", run, seconds, frames / seconds);
+		if (states != no_states) {
+			std::printf(", %.1f us and %llu bytes per state",
+			            stats.seconds / frames * 1e6, stats.bytes / frames);
+		}
+		std::printf("\n");
+		if (run == 1 || seconds < best)
+			best = seconds;
+	}
+
+	std::printf("best: %.3f s, %.1f fps, %.1fx realtime\n",
+	            best, frames / best, frames / best / gbFps);
+	return 0;
+}
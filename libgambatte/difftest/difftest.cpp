@@ -0,0 +1,152 @@
+// gambatte_difftest: runs a ROM on the threaded opcode dispatch and on the
+// plain switch in lockstep, and compares their savestates after every step.
+//
+//   gambatte_difftest ROM [frames] [-n samples]
+//
+// Each step is a runFor call of the given number of samples (2 cycles each,
+// 64 by default), so the states are compared every few instructions. Both
+// machines start from the same state; the first difference is reported with
+// the savestate field it falls in, and ends the run. Needs a library built
+// with GAMBATTE_DIFFTEST, which compiles both dispatch loops in.
+
+#include "gambatte.h"
+#include "debugger/Debugger.h"
+#include "easylogging++.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+INITIALIZE_EASYLOGGINGPP
+
+using namespace gambatte;
+
+namespace {
+
+void usage() {
+	std::fprintf(stderr, "usage: gambatte_difftest ROM [frames] [-n samples]\n");
+	std::exit(1);
+}
+
+unsigned long get24(std::vector<char> const &state, std::size_t pos) {
+	return (state[pos] & 0xFFul) << 16 | (state[pos + 1] & 0xFFul) << 8 | (state[pos + 2] & 0xFFul);
+}
+
+// Name of the savestate field holding byte `offset`: the version and
+// snapshot come first, then every field is a label, a 24-bit size and data.
+std::string fieldAt(std::vector<char> const &state, std::size_t const offset) {
+	std::size_t pos = 2;
+	if (offset < pos)
+		return "version";
+
+	pos += 3 + get24(state, pos);
+	if (offset < pos)
+		return "snapshot";
+
+	while (pos < state.size()) {
+		std::string const label(&state[pos]);
+		pos += label.size() + 1;
+		if (pos + 3 > state.size())
+			break;
+
+		pos += 3 + get24(state, pos);
+		if (offset < pos)
+			return label;
+	}
+
+	return "?";
+}
+
+unsigned long pc(GB &gb) {
+	return debugger::Debugger::Registers[debugger::Debugger::PcRegister].accessor(gb.debugger->cpu);
+}
+
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2)
+		usage();
+
+	char const *romPath = argv[1];
+	int frames = 600;
+	unsigned samples = 64;
+
+	for (int i = 2; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-n") && i + 1 < argc)
+			samples = std::strtoul(argv[++i], 0, 0);
+		else if (argv[i][0] != '-')
+			frames = std::atoi(argv[i]);
+		else
+			usage();
+	}
+
+	if (frames <= 0 || samples == 0 || samples > 35112)
+		usage();
+
+	std::ifstream file(romPath, std::ios::binary);
+	std::vector<char> const rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (rom.empty()) {
+		std::fprintf(stderr, "could not read %s\n", romPath);
+		return 1;
+	}
+
+	GB threaded, plain;
+	if (threaded.load(&rom[0], rom.size()) || plain.load(&rom[0], rom.size())) {
+		std::fprintf(stderr, "could not load %s\n", romPath);
+		return 1;
+	}
+
+	if (!threaded.setThreadedDispatch(true) || !plain.setThreadedDispatch(false)) {
+		std::fprintf(stderr, "this build has one dispatch loop; configure with -DGAMBATTE_DIFFTEST=ON\n");
+		return 1;
+	}
+
+	// The RTC base time comes from the host clock at load.
+	std::vector<char> a(threaded.stateSize()), b;
+	threaded.saveState(&a[0]);
+	plain.loadState(&a[0]);
+
+	static video_pixel_t videoBufs[2][160 * 144];
+	static uint_least32_t soundBufs[2][35112 + 2064];
+	unsigned long long steps = 0;
+
+	std::printf("%s: %d frames, %u samples per step\n", romPath, frames, samples);
+
+	for (int frame = 0; frame < frames;) {
+		unsigned threadedSamples = samples, plainSamples = samples;
+		long const threadedBlit = threaded.runFor(videoBufs[0], 160, soundBufs[0], threadedSamples);
+		long const plainBlit = plain.runFor(videoBufs[1], 160, soundBufs[1], plainSamples);
+		++steps;
+
+		a.resize(threaded.stateSize());
+		threaded.saveState(&a[0]);
+		b.resize(plain.stateSize());
+		plain.saveState(&b[0]);
+
+		std::size_t offset = 0;
+		while (offset < a.size() && offset < b.size() && a[offset] == b[offset])
+			++offset;
+
+		if (offset < a.size() || offset < b.size() || threadedBlit != plainBlit
+				|| threadedSamples != plainSamples) {
+			std::printf("mismatch at step %llu, frame %d, pc %04lx (threaded) %04lx (switch): ",
+			            steps, frame, pc(threaded), pc(plain));
+			if (offset < a.size() || offset < b.size())
+				std::printf("state field %s, byte %lu\n", fieldAt(a, offset).c_str(), (unsigned long)offset);
+			else
+				std::printf("runFor returned %ld/%u and %ld/%u\n",
+				            threadedBlit, threadedSamples, plainBlit, plainSamples);
+
+			return 1;
+		}
+
+		if (threadedBlit >= 0)
+			++frame;
+	}
+
+	std::printf("identical after %llu steps\n", steps);
+	return 0;
+}
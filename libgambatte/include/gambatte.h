@@ -36,6 +36,32 @@ typedef uint_least32_t video_pixel_t;
 #endif
 enum { BG_PALETTE = 0, SP1_PALETTE = 1, SP2_PALETTE = 2 };
 
+/** Execution counters, collected when built with GAMBATTE_PROFILE. */
+struct Profile {
+	unsigned long long opcodes[0x100];   /**< executions per opcode */
+	unsigned long long cbOpcodes[0x100]; /**< executions per CB-prefixed opcode */
+	/** Events dispatched by the memory event loop: unhalt, end, blit, serial,
+	  * oam, dma, tima, video and interrupts, in that order. */
+	unsigned long long events[9];
+	unsigned long long ioReads[0x100];   /**< non-trivial reads per FFxx register */
+	unsigned long long ioWrites[0x100];  /**< non-trivial writes per FFxx register */
+	unsigned long long pageReads[0x100];  /**< non-trivial reads per 256-byte page */
+	unsigned long long pageWrites[0x100]; /**< non-trivial writes per 256-byte page */
+	unsigned long long cpuNs;            /**< host time in the cpu loop, lcd and psg included */
+	unsigned long long lcdNs;            /**< host time in LCD::update */
+	unsigned long long psgNs;            /**< host time in PSG::generateSamples */
+};
+
+/** Where each region starts in the dirty page bitmap, in 256-byte pages.
+  * VRAM (both banks) takes the 0x40 pages before cartridge RAM. */
+struct DirtyLayout {
+	std::size_t sram;  /**< cartridge RAM, all banks */
+	std::size_t wram;  /**< work RAM, all banks */
+	std::size_t oam;   /**< 0xFE00-0xFEFF */
+	std::size_t hram;  /**< 0xFF00-0xFFFF, I/O registers and HRAM */
+	std::size_t pages; /**< bitmap size in bits */
+};
+
 class GB {
 public:
 	GB();
@@ -113,6 +139,28 @@ public:
    void loadState(const void *data);
    size_t stateSize() const;
 
+   /** Delta states store the state in full except for VRAM, cartridge RAM
+     * and WRAM, of which they keep only the 256-byte pages written since
+     * their base: the state at the last saveState, loadState, saveDeltaState
+     * or loadDeltaState. Only apply a delta to its own base. Writes are only
+     * tracked from the first saveDeltaState, deltaStateSize or takeDirtyPages
+     * on, so the first delta keeps every page.
+     */
+   void saveDeltaState(void *data);
+
+   /** Size of the delta saveDeltaState would write now. */
+   size_t deltaStateSize();
+
+   /** @return false if data isn't a delta state */
+   bool loadDeltaState(const void *data);
+
+   /** Merges a chain of deltas, oldest first, each the base of the next,
+     * into one delta from the base of the first to the state after the last.
+     * @param data output, or 0 to only get the size
+     * @return size of the merged delta, 0 if the chain isn't made of deltas
+     */
+   static size_t collapseDeltaStates(const void *const *deltas, size_t count, void *data);
+
    void setColorCorrection(bool enable);
    void setColorCorrectionMode(unsigned colorCorrectionMode);
    void setColorCorrectionBrightness(float colorCorrectionBrightness);
@@ -130,6 +178,63 @@ public:
    void setGameShark(const std::string &codes);
 
    void clearCheats();
+
+   /** Enables edge coverage for fuzzing. Every jump, call, return and branch
+     * increments an 8-bit counter at a hash of the previous and the new target
+     * (and the ROM bank, for targets in 0x4000-0x7FFF).
+     * @param size bitmap size in bytes, a power of two; 0 turns coverage off
+     * @param map  bitmap to update, e.g. shared memory read by a fuzzer;
+     *             if null, one is allocated internally
+     * @return false if size is not a power of two
+     */
+   bool setCoverage(std::size_t size, unsigned char *map = 0);
+   unsigned char const * coverage() const;
+   std::size_t coverageSize() const;
+
+   /** Zeroes the coverage bitmap and forgets the previous branch target. */
+   void clearCoverage();
+
+   /** Fast-forwards short loops that poll plain RAM (e.g. a flag set by an
+     * interrupt handler) to the next event, in whole iterations. Emulation
+     * is unaffected either way; on by default. Off while a debugger or
+     * coverage is active.
+     */
+   void setIdleLoopSkip(bool enable);
+
+   /** Chooses between the threaded opcode dispatch (default) and the plain
+     * switch, so that the two can be run side by side and compared. Only
+     * builds with GAMBATTE_DIFFTEST carry both; the debugger and coverage
+     * always use their own.
+     * @return false if this build can't run the requested one
+     */
+   bool setThreadedDispatch(bool enable);
+
+   /** Cycles run since the ROM was loaded, and how many of those were
+     * skipped in idle loops.
+     */
+   void idleLoopStats(unsigned long long &cycles, unsigned long long &skipped) const;
+
+   /** Layout of the dirty page bitmap, zeroed while no ROM is loaded.
+     * A page is flagged by every cpu, OAM DMA and HDMA write to it, and all
+     * pages are on load, reset and loadState. Delta states track their pages
+     * separately, so taking these doesn't affect them. Writes made through
+     * savedata_ptr() and the other raw memory pointers aren't seen.
+     */
+   void dirtyLayout(DirtyLayout &layout) const;
+
+   /** Copies the dirty page bitmap and clears it, page n being bit n % 64
+     * of bitmap[n / 64]. May run alongside runFor on another thread: a page
+     * written meanwhile is reported now or next time, maybe both. Writes
+     * aren't tracked before the first call, which reports every page.
+     * @param bitmap (DirtyLayout::pages + 63) / 64 words
+     */
+   void takeDirtyPages(unsigned long long *bitmap);
+
+   /** Copies the profiling counters into snapshot.
+     * @return false, leaving snapshot untouched, unless built with GAMBATTE_PROFILE
+     */
+   bool profile(Profile &snapshot) const;
+   void clearProfile();
    
 #ifdef __LIBRETRO__
    void *vram_ptr() const;
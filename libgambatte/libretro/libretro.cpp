@@ -32,6 +32,10 @@ extern "C" void* linearMemAlign(size_t size, size_t alignment);
 extern "C" void linearFree(void* mem);
 #endif
 
+#ifdef HAVE_COVERAGE_SHM
+#include <sys/shm.h>
+#endif
+
 #include "easylogging++.h"
 
 INITIALIZE_EASYLOGGINGPP
@@ -241,6 +245,49 @@ static void check_system_specs(void)
 
 static void log_null(enum retro_log_level level, const char *fmt, ...) {}
 
+#ifdef HAVE_COVERAGE_SHM
+static void *coverage_shm = NULL;
+
+// Turns coverage off and detaches the fuzzer's bitmap, if one is attached.
+static void detach_coverage(void)
+{
+   if (!coverage_shm)
+      return;
+
+   gb.setCoverage(0);
+   shmdt(coverage_shm);
+   coverage_shm = NULL;
+}
+#endif
+
+static void start_gdb_server(void)
+{
+   struct retro_variable var = {0};
+   std::string address = "0.0.0.0";
+   int port = 55555;
+
+   var.key = "gambatte_gdb_server";
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value
+         && !strcmp(var.value, "disabled"))
+      return;
+
+   var.key = "gambatte_gdb_port";
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      port = atoi(var.value);
+
+   var.key = "gambatte_gdb_address";
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      address = var.value;
+
+   // Both Game Boys share one endpoint, as threads 1 and 2. While one is
+   // halted the frontend thread waits inside it, and the stub serves the
+   // other's commands itself.
+   gb.debugger->StartGdbStub(address, port);
+#ifdef DUAL_MODE
+   gb2.debugger->StartGdbStub(address, port);
+#endif
+}
+
 void retro_init(void)
 {
    struct retro_log_callback log;
@@ -311,8 +358,8 @@ void retro_init(void)
 
    if (environ_cb(RETRO_ENVIRONMENT_GET_INPUT_BITMASKS, NULL))
       libretro_supports_bitmasks = true;
-    
-    gb.debugger->StartGdbStub();
+
+   start_gdb_server();
 }
 
 void retro_deinit(void)
@@ -328,6 +375,9 @@ void retro_deinit(void)
 #endif
    video_buf = NULL;
    libretro_supports_bitmasks = false;
+#ifdef HAVE_COVERAGE_SHM
+   detach_coverage();
+#endif
 }
 
 void retro_set_environment(retro_environment_t cb)
@@ -986,6 +1036,26 @@ bool retro_load_game(const struct retro_game_info *info)
 
    if (gb.load(info->data, info->size, flags) != 0)
       return false;
+
+#ifdef HAVE_COVERAGE_SHM
+   // Under an AFL-style fuzzer, feed edge coverage into its shared bitmap.
+   detach_coverage();
+   if (const char *shm_id = getenv("__AFL_SHM_ID"))
+   {
+      const char *map_size = getenv("AFL_MAP_SIZE");
+      std::size_t size = map_size ? strtoul(map_size, NULL, 10) : 1 << 16;
+      void *map = shmat(atoi(shm_id), NULL, 0);
+
+      if (map != (void*)-1 && gb.setCoverage(size, (unsigned char*)map))
+         coverage_shm = map;
+      else
+      {
+         if (map != (void*)-1)
+            shmdt(map);
+         log_cb(RETRO_LOG_WARN, "[Gambatte]: Could not attach coverage bitmap %s.\n", shm_id);
+      }
+   }
+#endif
 #ifdef DUAL_MODE
    if (gb2.load(info->data, info->size, flags) != 0)
       return false;
@@ -1037,7 +1107,18 @@ bool retro_load_game_special(unsigned, const struct retro_game_info*, size_t) {
 
 void retro_unload_game()
 {
+   if (rom_loaded)
+   {
+      unsigned long long cycles, skipped;
+      gb.idleLoopStats(cycles, skipped);
+      if (cycles)
+         log_cb(RETRO_LOG_INFO, "[Gambatte]: idle loops skipped %llu of %llu cycles (%.1f%%).\n",
+               skipped, cycles, 100.0 * skipped / cycles);
+   }
    rom_loaded = false;
+#ifdef HAVE_COVERAGE_SHM
+   detach_coverage();
+#endif
 }
 
 unsigned retro_get_region() { return RETRO_REGION_NTSC; }
@@ -301,6 +301,53 @@ struct retro_core_option_definition option_defs_us[] = {
       },
       "disabled"
    },
+   {
+      "gambatte_gdb_server",
+      "GDB Server (restart)",
+      "Start a GDB remote debugging server with the core. Every emulated Game Boy is listed as its own thread.",
+      {
+         { "enabled",  NULL },
+         { "disabled", NULL },
+         { NULL, NULL },
+      },
+      "enabled"
+   },
+   {
+      "gambatte_gdb_port",
+      "GDB Server Port (restart)",
+      "Specify the TCP port the GDB server listens on.",
+      {
+         { "55555", NULL },
+         { "55556", NULL },
+         { "55557", NULL },
+         { "55558", NULL },
+         { "55559", NULL },
+         { "55560", NULL },
+         { "55561", NULL },
+         { "55562", NULL },
+         { "55563", NULL },
+         { "55564", NULL },
+         { "55565", NULL },
+         { "55566", NULL },
+         { "55567", NULL },
+         { "55568", NULL },
+         { "55569", NULL },
+         { "55570", NULL },
+         { NULL, NULL },
+      },
+      "55555"
+   },
+   {
+      "gambatte_gdb_address",
+      "GDB Server Address (restart)",
+      "Specify the address the GDB server listens on. 'Localhost' only accepts debuggers running on this machine.",
+      {
+         { "0.0.0.0",   "All Interfaces" },
+         { "127.0.0.1", "Localhost" },
+         { NULL, NULL },
+      },
+      "0.0.0.0"
+   },
 #ifdef HAVE_NETWORK
    {
       "gambatte_show_gb_link_settings",
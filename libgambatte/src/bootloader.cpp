@@ -41,17 +41,21 @@ void Bootloader::load(bool isgbc, bool isgba) {
    if (isgba)//patch bootloader to fake gba mode
       patch_gbc_to_gba_mode();
    
+   using_bootloader = true;
+}
+
+void Bootloader::map(void* start) {
+   addrspace_start = start;
+   
    //backup rom segment that is shared with bootloader
    std::memcpy(rombackup, (uint8_t*)addrspace_start, bootloadersize);
    
    //put back cartridge data in a 256 byte window of the bios that is not mapped(GBC only)
-   if (isgbc)
+   if (bootloadersize == 0x900)
       std::memcpy(bootromswapspace + 0x100, rombackup + 0x100, 0x100);
    
    //put bootloader in main memory
    std::memcpy((uint8_t*)addrspace_start, bootromswapspace, bootloadersize);
-   
-   using_bootloader = true;
 }
 
 void Bootloader::reset() {
@@ -65,10 +69,6 @@ void Bootloader::set_bootloader_getter(bool (*getter)(void* userdata, bool isgbc
    get_raw_bootloader_data = getter;
 }
 
-void Bootloader::set_address_space_start(void* start) {
-   addrspace_start = start;
-}
-
 void Bootloader::choosebank(bool inbootloader) {
    //inbootloader = (state.mem.ioamhram.get()[0x150] != 0xFF);//do not uncomment this is just for reference
    if (using_bootloader) {
@@ -31,7 +31,8 @@ public:
 
    void set_bootloader_getter(bool (*getter)(void* userdata, bool isgbc, uint8_t* data, uint32_t buf_size));
    
-   void set_address_space_start(void* start);
+   //backs up the rom at start and puts the loaded bootloader there instead
+   void map(void* start);
 
    void choosebank(bool inbootloader);
 
@@ -19,6 +19,7 @@
 #include "cpu.h"
 #include "gambatte-memory.h"
 #include "savestate.h"
+#include <algorithm>
 
 namespace gambatte {
 
@@ -39,16 +40,56 @@ CPU::CPU()
 , h(0x01)
 , l(0x4D)
 , skip_(false)
+, idleLoopSkip_(true)
+, threadedDispatch_(true)
+, idleLoopCycles_(0)
+, idleLoopSkipped_(0)
 {
+	idleLoop_.end = 0;
 }
 
 long CPU::runFor(unsigned long const cycles) {
-	process(cycles);
+	PROFILE_TIME(mem_.profile().cpuNs);
+
+	// The debugger hooks are compiled out of the plain variant, so the choice
+	// is only revisited here, between calls. Commands served here see the pc
+	// the next call resumes from.
+	correct_pc = pc_;
+	debugger->ProcessCommands();
+
+	if (debugger->IsActive()) {
+		debugger->RecordHistory();
+
+		if (mem_.coverage())
+			process<true, true, false>(cycles);
+		else
+			process<true, false, false>(cycles);
+
+		// Reverse execution leaves the loop early; the snapshot can only
+		// be loaded once none of its state is held in locals.
+		if (debugger->RewindPending())
+			debugger->Rewind();
+	} else if (mem_.coverage())
+		process<false, true, true>(cycles);
+#ifdef GAMBATTE_DIFFTEST
+	else if (!threadedDispatch_)
+		process<false, false, false>(cycles);
+#endif
+	else
+		process<false, false, true>(cycles);
+
+	// Likewise for gdb commands run on its own thread until the next call.
+	correct_pc = pc_;
 
 	long const csb = mem_.cyclesSinceBlit(cycleCounter_);
+	if (csb >= 0)
+		debugger->FrameCompleted();
 
-	if (cycleCounter_ & 0x80000000)
+	if (cycleCounter_ & 0x80000000) {
+		unsigned long const oldCc = cycleCounter_;
 		cycleCounter_ = mem_.resetCounters(cycleCounter_);
+		debugger->CyclesRebased(oldCc, cycleCounter_);
+	}
 
 	return csb;
 }
@@ -84,8 +125,14 @@ void CPU::setStatePtrs(SaveState &state) {
 	mem_.setStatePtrs(state);
 }
 
+unsigned CPU::f() const {
+	return toF(updateHf2FromHf1(hf1, hf2), cf, zf);
+}
+
 void CPU::saveState(SaveState &state) {
+	unsigned long const oldCc = cycleCounter_;
 	cycleCounter_ = mem_.saveState(state, cycleCounter_);
+	debugger->CyclesRebased(oldCc, cycleCounter_);
 	hf2 = updateHf2FromHf1(hf1, hf2);
 
 	state.cpu.cycleCounter = cycleCounter_;
@@ -105,8 +152,10 @@ void CPU::saveState(SaveState &state) {
 void CPU::loadState(SaveState const &state) {
 	mem_.loadState(state);
 
+	debugger->CyclesRebased(cycleCounter_, state.cpu.cycleCounter);
 	cycleCounter_ = state.cpu.cycleCounter;
 	pc_ = state.cpu.pc & 0xFFFF;
+	correct_pc = pc_;
 	sp = state.cpu.sp & 0xFFFF;
 	a_ = state.cpu.a & 0xFF;
 	b = state.cpu.b & 0xFF;
@@ -137,7 +186,14 @@ void CPU::loadState(SaveState const &state) {
 #define WRITE(addr, data) do { mem_.write(addr, data, cycleCounter); cycleCounter += 4; } while (0)
 #define FF_WRITE(addr, data) do { mem_.ff_write(addr, data, cycleCounter); cycleCounter += 4; } while (0)
 
-#define PC_MOD(data) do { pc = data; cycleCounter += 4; } while (0)
+// Every change of flow, taken or not; interrupt dispatch is counted by
+// Memory::event.
+#define COVER_EDGE(to) do { \
+	if (coverage) \
+		mem_.coverEdge(to); \
+} while (0)
+
+#define PC_MOD(data) do { pc = data; cycleCounter += 4; COVER_EDGE(pc); } while (0)
 
 #define PUSH(r1, r2) do { \
 	sp = (sp - 1) & 0xFFFF; \
@@ -455,11 +511,15 @@ void CPU::loadState(SaveState const &state) {
 
 // jr disp (12 cycles):
 // Jump to value of next (signed) byte in memory+current address:
+// A jump of 2 to 16 bytes back may close an idle loop.
 #define jr_disp() do { \
 	unsigned disp; \
 	PC_READ(disp); \
 	disp = (disp ^ 0x80) - 0x80; \
+	unsigned const end = pc; \
 	PC_MOD((pc + disp) & 0xFFFF); \
+	if (!debug && !coverage && idleLoopSkip_ && disp - (0u - 16) <= 14) \
+		cycleCounter = skipIdleLoop(pc, end, a, cycleCounter); \
 } while (0)
 
 // CALLS, RESTARTS AND RETURNS:
@@ -486,12 +546,200 @@ void CPU::loadState(SaveState const &state) {
 	PC_MOD(high << 8 | low); \
 } while (0)
 
+// Stops right away for a HALT/STOP catchpoint, before the cpu sleeps until
+// the next event. Mirrors the per-instruction debugger hook.
+#define CATCH_HALT(stop, armed, length) do { \
+	if (debug && debugger->armed) { \
+		a_ = a; \
+		correct_pc = pc; \
+		cycleCounter_ = cycleCounter; \
+		debugger->CatchHalt(stop, (pc - length) & 0xFFFF); \
+		debugger->WaitWhileHalted(); \
+		if (debugger->RewindPending()) { \
+			pc_ = pc; \
+			return; \
+		} \
+	} \
+} while (0)
+
+#define FETCH_OPCODE() do { \
+	PC_READ(opcode); \
+	PROFILE(++mem_.profile().opcodes[opcode]); \
+	if (skip_) { \
+		pc = (pc - 1) & 0xFFFF; \
+		skip_ = false; \
+	} \
+} while (0)
+
+// With GCC and Clang every opcode ends by fetching and jumping straight to
+// the next one, giving the branch predictor one indirect jump per opcode
+// instead of the single one of the switch. The debugger hooks still run at
+// the top of the loop, so the debug build always goes back there.
+#if defined(__GNUC__) && !defined(GAMBATTE_NO_THREADED_DISPATCH)
+#define THREADED_DISPATCH
+
+#define OPCODE(n) case n: op_##n
+
+#define NEXT_OPCODE \
+	if (threaded && !debug && cycleCounter < mem_.nextEventTime()) { \
+		FETCH_OPCODE(); \
+		goto *opcodes[opcode]; \
+	} \
+	break
+
+#define OPCODE_ROW(h) \
+	&&op_0x##h##0, &&op_0x##h##1, &&op_0x##h##2, &&op_0x##h##3, \
+	&&op_0x##h##4, &&op_0x##h##5, &&op_0x##h##6, &&op_0x##h##7, \
+	&&op_0x##h##8, &&op_0x##h##9, &&op_0x##h##A, &&op_0x##h##B, \
+	&&op_0x##h##C, &&op_0x##h##D, &&op_0x##h##E, &&op_0x##h##F
+#else
+#define OPCODE(n) case n
+#define NEXT_OPCODE break
+#endif
+
+bool CPU::setThreadedDispatch(bool const enable) {
+#if defined(THREADED_DISPATCH) && defined(GAMBATTE_DIFFTEST)
+	threadedDispatch_ = enable;
+	return true;
+#elif defined(THREADED_DISPATCH)
+	return enable;
+#else
+	return !enable;
+#endif
+}
+
+bool CPU::isIdleLoopBody(unsigned const target, unsigned const end) const {
+	// Only instructions that read plain memory and write nothing but A and
+	// the flags. The address registers then stay put, so every read hits
+	// the same byte on every pass, and the loop is a fixed point once its
+	// registers repeat.
+	unsigned p = target;
+	while (p < end - 2) {
+		int const op = mem_.plainRead(p);
+		int addr = -1;
+		unsigned length = 1;
+
+		switch (op) {
+		case 0x00: // nop
+		case 0x07: case 0x0F: case 0x17: case 0x1F: // rlca rrca rla rra
+		case 0x27: case 0x2F: case 0x37: case 0x3F: // daa cpl scf ccf
+			break;
+		case 0x0A: addr = b << 8 | c; break; // ld a,(bc)
+		case 0x1A: addr = d << 8 | e; break; // ld a,(de)
+		case 0x3E: // ld a,n
+		case 0xC6: case 0xCE: case 0xD6: case 0xDE: // alu a,n
+		case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+			length = 2;
+			break;
+		case 0xF0: // ldh a,(n); HRAM and IE only
+			if (mem_.plainRead(p + 1) < 0x80)
+				return false;
+
+			length = 2;
+			break;
+		case 0xF2: // ld a,(c)
+			if (c < 0x80)
+				return false;
+
+			break;
+		case 0xFA: // ld a,(nn)
+			if (mem_.plainRead(p + 1) < 0 || mem_.plainRead(p + 2) < 0)
+				return false;
+
+			addr = mem_.plainRead(p + 2) << 8 | mem_.plainRead(p + 1);
+			length = 3;
+			break;
+		case 0xCB: // bit n,r; rotates and shifts of a
+			{
+				int const cb = mem_.plainRead(p + 1);
+				if (cb >= 0x40 && cb < 0x80) {
+					if ((cb & 7) == 6)
+						addr = h << 8 | l;
+				} else if (cb < 0 || cb >= 0x40 || (cb & 7) != 7)
+					return false;
+
+				length = 2;
+			}
+
+			break;
+		default:
+			if (op >= 0x78 && op < 0xC0) { // ld a,r; alu a,r
+				if ((op & 7) == 6)
+					addr = h << 8 | l;
+
+				break;
+			}
+
+			return false;
+		}
+
+		if (addr >= 0 && mem_.plainRead(addr) < 0)
+			return false;
+
+		for (unsigned i = 1; i < length; ++i) {
+			if (mem_.plainRead(p + i) < 0)
+				return false;
+		}
+
+		p += length;
+	}
+
+	return p == end - 2 && mem_.plainRead(p) >= 0 && mem_.plainRead(p + 1) >= 0;
+}
+
+unsigned long CPU::skipIdleLoop(unsigned const target, unsigned const end, unsigned const a,
+		unsigned long const cc) {
+	unsigned const regs[12] = { a, b, c, d, e, h, l, sp, hf1, hf2, zf, cf };
+
+	if (target != idleLoop_.target || end != idleLoop_.end
+			|| !std::equal(regs, regs + 12, idleLoop_.regs)) {
+		idleLoop_.target = target;
+		idleLoop_.end = end;
+		idleLoop_.cc = cc;
+		std::copy(regs, regs + 12, idleLoop_.regs);
+		idleLoop_.checked = false;
+		return cc;
+	}
+
+	// Same loop, same registers, and no event since: nothing that happens
+	// before the next event can make the next pass any different.
+	unsigned long const length = cc - idleLoop_.cc;
+	idleLoop_.cc = cc;
+
+	if (!idleLoop_.checked) {
+		idleLoop_.idle = target < end && isIdleLoopBody(target, end);
+		idleLoop_.checked = true;
+	}
+
+	if (!idleLoop_.idle || cc >= mem_.nextEventTime())
+		return cc;
+
+	// Whole passes only, ending no later than the event, exactly where the
+	// loop would have been had it run them.
+	unsigned long const skipped = (mem_.nextEventTime() - cc) / length * length;
+	idleLoopSkipped_ += skipped;
+	idleLoop_.cc = cc + skipped;
+	return cc + skipped;
+}
+
+template<bool debug, bool coverage, bool threaded>
 void CPU::process(unsigned long const cycles) {
 	mem_.setEndtime(cycleCounter_, cycles);
 	mem_.updateInput();
 
 	unsigned char a = a_;
 	unsigned long cycleCounter = cycleCounter_;
+	unsigned long const start = cycleCounter;
+	idleLoop_.end = 0;
+
+#ifdef THREADED_DISPATCH
+	static void const *const opcodes[0x100] = {
+		OPCODE_ROW(0), OPCODE_ROW(1), OPCODE_ROW(2), OPCODE_ROW(3),
+		OPCODE_ROW(4), OPCODE_ROW(5), OPCODE_ROW(6), OPCODE_ROW(7),
+		OPCODE_ROW(8), OPCODE_ROW(9), OPCODE_ROW(A), OPCODE_ROW(B),
+		OPCODE_ROW(C), OPCODE_ROW(D), OPCODE_ROW(E), OPCODE_ROW(F)
+	};
+#endif
 
 	while (mem_.isActive()) {
 		unsigned short pc = pc_;
@@ -507,51 +755,60 @@ void CPU::process(unsigned long const cycles) {
 			}
 		} else while (cycleCounter < mem_.nextEventTime()) {
 			unsigned char opcode;
-            correct_pc = pc;
-            debugger->CheckForBreakpoints(pc);
-            debugger->WaitWhileHalted();
 
-			PC_READ(opcode);
+			if (debug) {
+				a_ = a;
+				correct_pc = pc;
+				cycleCounter_ = cycleCounter;
+				debugger->ProcessCommands();
+				debugger->CheckForBreakpoints(pc);
+				debugger->WaitWhileHalted();
+
+				if (debugger->RewindPending()) {
+					pc_ = pc;
+					return;
+				}
 
-			if (skip_) {
-				pc = (pc - 1) & 0xFFFF;
-				skip_ = false;
+				debugger->TraceInstruction();
+				++debugger->position;
 			}
 
+			FETCH_OPCODE();
+
 			switch (opcode) {
-			case 0x00:
-				break;
-			case 0x01:
+			OPCODE(0x00):
+				NEXT_OPCODE;
+			OPCODE(0x01):
 				ld_rr_nn(b, c);
-				break;
-			case 0x02:
+				NEXT_OPCODE;
+			OPCODE(0x02):
 				WRITE(bc(), a);
-				break;
-			case 0x03:
+				NEXT_OPCODE;
+			OPCODE(0x03):
 				inc_rr(b, c);
-				break;
-			case 0x04:
+				NEXT_OPCODE;
+			OPCODE(0x04):
 				inc_r(b);
-				break;
-			case 0x05:
+				NEXT_OPCODE;
+			OPCODE(0x05):
 				dec_r(b); 
-				break;
-			case 0x06:
+				NEXT_OPCODE;
+			OPCODE(0x06):
 				PC_READ(b);
-				break;
+				NEXT_OPCODE;
 
 				// rlca (4 cycles):
 				// Rotate 8-bit register A left, store old bit7 in CF. Reset SF, HCF, ZF:
-			case 0x07:
+			OPCODE(0x07):
 				cf = a << 1;
 				a = (cf | cf >> 8) & 0xFF;
 				hf2 = 0;
 				zf = 1;
-				break;
+				NEXT_OPCODE;
 
 				// ld (nn),SP (20 cycles):
 				// Put value of SP into address given by next 2 bytes in memory:
-			case 0x08:
+			OPCODE(0x08):
 				{
 					unsigned imml, immh;
 					PC_READ(imml);
@@ -562,73 +819,74 @@ void CPU::process(unsigned long const cycles) {
 					WRITE((addr + 1) & 0xFFFF, sp >> 8);
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0x09:
+			OPCODE(0x09):
 				add_hl_rr(b, c);
-				break;
-			case 0x0A:
+				NEXT_OPCODE;
+			OPCODE(0x0A):
 				READ(a, bc());
-				break;
-			case 0x0B:
+				NEXT_OPCODE;
+			OPCODE(0x0B):
 				dec_rr(b, c);
-				break;
-			case 0x0C:
+				NEXT_OPCODE;
+			OPCODE(0x0C):
 				inc_r(c);
-				break;
-			case 0x0D:
+				NEXT_OPCODE;
+			OPCODE(0x0D):
 				dec_r(c);
-				break;
-			case 0x0E:
+				NEXT_OPCODE;
+			OPCODE(0x0E):
 				PC_READ(c);
-				break;
+				NEXT_OPCODE;
 
 				// rrca (4 cycles):
 				// Rotate 8-bit register A right, store old bit0 in CF. Reset SF, HCF, ZF:
-			case 0x0F:
+			OPCODE(0x0F):
 				cf = a << 8 | a;
 				a = cf >> 1 & 0xFF;
 				hf2 = 0;
 				zf = 1;
-				break;
+				NEXT_OPCODE;
 
 				// stop (4 cycles):
 				// Halt CPU and LCD display until button pressed:
-			case 0x10:
+			OPCODE(0x10):
 				pc = (pc + 1) & 0xFFFF;
 
 				cycleCounter = mem_.stop(cycleCounter);
+				CATCH_HALT(true, catch_stop, 2);
 
 				if (cycleCounter < mem_.nextEventTime()) {
 					unsigned long cycles = mem_.nextEventTime() - cycleCounter;
 					cycleCounter += cycles + (-cycles & 3);
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0x11:
+			OPCODE(0x11):
 				ld_rr_nn(d, e);
-				break;
-			case 0x12:
+				NEXT_OPCODE;
+			OPCODE(0x12):
 				WRITE(de(), a);
-				break;
-			case 0x13:
+				NEXT_OPCODE;
+			OPCODE(0x13):
 				inc_rr(d, e);
-				break;
-			case 0x14:
+				NEXT_OPCODE;
+			OPCODE(0x14):
 				inc_r(d);
-				break;
-			case 0x15:
+				NEXT_OPCODE;
+			OPCODE(0x15):
 				dec_r(d);
-				break;
-			case 0x16:
+				NEXT_OPCODE;
+			OPCODE(0x16):
 				PC_READ(d);
-				break;
+				NEXT_OPCODE;
 
 				// rla (4 cycles):
 				// Rotate 8-bit register A left through CF, store old bit7 in CF,
 				// old CF value becomes bit0. Reset SF, HCF, ZF:
-			case 0x17:
+			OPCODE(0x17):
 				{
 					unsigned oldcf = cf >> 8 & 1;
 					cf = a << 1;
@@ -637,34 +895,34 @@ void CPU::process(unsigned long const cycles) {
 
 				hf2 = 0;
 				zf = 1;
-				break;
+				NEXT_OPCODE;
 
-			case 0x18:
+			OPCODE(0x18):
 				jr_disp();
-				break;
-			case 0x19:
+				NEXT_OPCODE;
+			OPCODE(0x19):
 				add_hl_rr(d, e);
-				break;
-			case 0x1A:
+				NEXT_OPCODE;
+			OPCODE(0x1A):
 				READ(a, de());
-				break;
-			case 0x1B:
+				NEXT_OPCODE;
+			OPCODE(0x1B):
 				dec_rr(d, e);
-				break;
-			case 0x1C:
+				NEXT_OPCODE;
+			OPCODE(0x1C):
 				inc_r(e);
-				break;
-			case 0x1D:
+				NEXT_OPCODE;
+			OPCODE(0x1D):
 				dec_r(e);
-				break;
-			case 0x1E:
+				NEXT_OPCODE;
+			OPCODE(0x1E):
 				PC_READ(e);
-				break;
+				NEXT_OPCODE;
 
 				// rra (4 cycles):
 				// Rotate 8-bit register A right through CF, store old bit0 in CF,
 				// old CF value becomes bit7. Reset SF, HCF, ZF:
-			case 0x1F:
+			OPCODE(0x1F):
 				{
 					unsigned oldcf = cf & 0x100;
 					cf = a << 8;
@@ -673,24 +931,24 @@ void CPU::process(unsigned long const cycles) {
 
 				hf2 = 0;
 				zf = 1;
-				break;
+				NEXT_OPCODE;
 
 				// jr nz,disp (12;8 cycles):
 				// Jump to value of next (signed) byte in memory+current address if ZF is unset:
-			case 0x20:
+			OPCODE(0x20):
 				if (zf & 0xFF) {
 					jr_disp();
 				} else {
 					PC_MOD((pc + 1) & 0xFFFF);
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0x21: ld_rr_nn(h, l); break;
+			OPCODE(0x21): ld_rr_nn(h, l); NEXT_OPCODE;
 
 				// ldi (hl),a (8 cycles):
 				// Put A into memory address in hl. Increment HL:
-			case 0x22:
+			OPCODE(0x22):
 				{
 					unsigned addr = hl();
 					WRITE(addr, a);
@@ -700,24 +958,24 @@ void CPU::process(unsigned long const cycles) {
 					h = addr >> 8;
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0x23:
+			OPCODE(0x23):
 				inc_rr(h, l);
-				break;
-			case 0x24:
+				NEXT_OPCODE;
+			OPCODE(0x24):
 				inc_r(h);
-				break;
-			case 0x25:
+				NEXT_OPCODE;
+			OPCODE(0x25):
 				dec_r(h);
-				break;
-			case 0x26:
+				NEXT_OPCODE;
+			OPCODE(0x26):
 				PC_READ(h);
-				break;
+				NEXT_OPCODE;
 
 				// daa (4 cycles):
 				// Adjust register A to correctly represent a BCD. Check ZF, HF and CF:
-			case 0x27:
+			OPCODE(0x27):
 				hf2 = updateHf2FromHf1(hf1, hf2);
 
 				{
@@ -741,26 +999,26 @@ void CPU::process(unsigned long const cycles) {
 					a &= 0xFF;
 				}
 
-				break;
+				NEXT_OPCODE;
 
 				// jr z,disp (12;8 cycles):
 				// Jump to value of next (signed) byte in memory+current address if ZF is set:
-			case 0x28:
+			OPCODE(0x28):
 				if (zf & 0xFF) {
 					PC_MOD((pc + 1) & 0xFFFF);
 				} else {
 					jr_disp();
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0x29:
+			OPCODE(0x29):
 				add_hl_rr(h, l);
-				break;
+				NEXT_OPCODE;
 
 				// ldi a,(hl) (8 cycles):
 				// Put value at address in hl into A. Increment HL:
-			case 0x2A:
+			OPCODE(0x2A):
 				{
 					unsigned addr = hl();
 					READ(a, addr);
@@ -770,42 +1028,42 @@ void CPU::process(unsigned long const cycles) {
 					h = addr >> 8;
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0x2B:
+			OPCODE(0x2B):
 				dec_rr(h, l);
-				break;
-			case 0x2C:
+				NEXT_OPCODE;
+			OPCODE(0x2C):
 				inc_r(l);
-				break;
-			case 0x2D:
+				NEXT_OPCODE;
+			OPCODE(0x2D):
 				dec_r(l);
-				break;
-			case 0x2E:
+				NEXT_OPCODE;
+			OPCODE(0x2E):
 				PC_READ(l);
-				break;
+				NEXT_OPCODE;
 
 				// cpl (4 cycles):
 				// Complement register A. (Flip all bits), set SF and HCF:
-			case 0x2F:
+			OPCODE(0x2F):
 				hf2 = hf2_subf | hf2_hcf;
 				a ^= 0xFF;
-				break;
+				NEXT_OPCODE;
 
 				// jr nc,disp (12;8 cycles):
 				// Jump to value of next (signed) byte in memory+current address if CF is unset:
-			case 0x30:
+			OPCODE(0x30):
 				if (cf & 0x100) {
 					PC_MOD((pc + 1) & 0xFFFF);
 				} else {
 					jr_disp();
 				}
 
-				break;
+				NEXT_OPCODE;
 
 				// ld sp,nn (12 cycles)
 				// set sp to 16-bit value of next 2 bytes in memory
-			case 0x31:
+			OPCODE(0x31):
 				{
 					unsigned imml, immh;
 					PC_READ(imml);
@@ -814,11 +1072,11 @@ void CPU::process(unsigned long const cycles) {
 					sp = immh << 8 | imml;
 				}
 
-				break;
+				NEXT_OPCODE;
 
 				// ldd (hl),a (8 cycles):
 				// Put A into memory address in hl. Decrement HL:
-			case 0x32:
+			OPCODE(0x32):
 				{
 					unsigned addr = hl();
 					WRITE(addr, a);
@@ -828,16 +1086,16 @@ void CPU::process(unsigned long const cycles) {
 					h = addr >> 8;
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0x33:
+			OPCODE(0x33):
 				sp = (sp + 1) & 0xFFFF;
 				cycleCounter += 4;
-				break;
+				NEXT_OPCODE;
 
 				// inc (hl) (12 cycles):
 				// Increment value at address in hl, check flags except CF:
-			case 0x34:
+			OPCODE(0x34):
 				{
 					unsigned const addr = hl();
 					READ(hf2, addr);
@@ -846,11 +1104,11 @@ void CPU::process(unsigned long const cycles) {
 					hf2 |= hf2_incf;
 				}
 
-				break;
+				NEXT_OPCODE;
 
 				// dec (hl) (12 cycles):
 				// Decrement value at address in hl, check flags except CF:
-			case 0x35:
+			OPCODE(0x35):
 				{
 					unsigned const addr = hl();
 					READ(hf2, addr);
@@ -859,40 +1117,40 @@ void CPU::process(unsigned long const cycles) {
 					hf2 |= hf2_incf | hf2_subf;
 				}
 
-				break;
+				NEXT_OPCODE;
 
 				// ld (hl),n (12 cycles):
 				// set memory at address in hl to value of next byte in memory:
-			case 0x36:
+			OPCODE(0x36):
 				{
 					unsigned imm;
 					PC_READ(imm);
 					WRITE(hl(), imm);
 				}
 
-				break;
+				NEXT_OPCODE;
 
 				// scf (4 cycles):
 				// Set CF. Unset SF and HCF:
-			case 0x37:
+			OPCODE(0x37):
 				cf = 0x100;
 				hf2 = 0;
-				break;
+				NEXT_OPCODE;
 
 				// jr c,disp (12;8 cycles):
 				// Jump to value of next (signed) byte in memory+current address if CF is set:
-			case 0x38:
+			OPCODE(0x38):
 				if (cf & 0x100) {
 					jr_disp();
 				} else {
 					PC_MOD((pc + 1) & 0xFFFF);
 				}
 
-				break;
+				NEXT_OPCODE;
 
 				// add hl,sp (8 cycles):
 				// add SP to HL, check flags except ZF:
-			case 0x39:
+			OPCODE(0x39):
 				cf = l + sp;
 				l = cf & 0xFF;
 				hf1 = h;
@@ -901,11 +1159,11 @@ void CPU::process(unsigned long const cycles) {
 				cf += h;
 				h = cf & 0xFF;
 				cycleCounter += 4;
-				break;
+				NEXT_OPCODE;
 
 				// ldd a,(hl) (8 cycles):
 				// Put value at address in hl into A. Decrement HL:
-			case 0x3A:
+			OPCODE(0x3A):
 				{
 					unsigned addr = hl();
 					a = mem_.read(addr, cycleCounter);
@@ -916,93 +1174,93 @@ void CPU::process(unsigned long const cycles) {
 					h = addr >> 8;
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0x3B:
+			OPCODE(0x3B):
 				sp = (sp - 1) & 0xFFFF;
 				cycleCounter += 4;
-				break;
+				NEXT_OPCODE;
 
-			case 0x3C:
+			OPCODE(0x3C):
 				inc_r(a);
-				break;
-			case 0x3D:
+				NEXT_OPCODE;
+			OPCODE(0x3D):
 				dec_r(a);
-				break;
-			case 0x3E:
+				NEXT_OPCODE;
+			OPCODE(0x3E):
 				PC_READ(a);
-				break;
+				NEXT_OPCODE;
 
 				// ccf (4 cycles):
 				// Complement CF (unset if set vv.) Unset SF and HCF.
-			case 0x3F:
+			OPCODE(0x3F):
 				cf ^= 0x100;
 				hf2 = 0;
-				break;
-
-			case 0x40: /*b = b;*/ break;
-			case 0x41: b = c; break;
-			case 0x42: b = d; break;
-			case 0x43: b = e; break;
-			case 0x44: b = h; break;
-			case 0x45: b = l; break;
-			case 0x46: READ(b, hl()); break;
-			case 0x47: b = a; break;
-
-			case 0x48: c = b; break;
-			case 0x49: /*c = c;*/ break;
-			case 0x4A: c = d; break;
-			case 0x4B: c = e; break;
-			case 0x4C: c = h; break;
-			case 0x4D: c = l; break;
-			case 0x4E: READ(c, hl()); break;
-			case 0x4F: c = a; break;
-
-			case 0x50: d = b; break;
-			case 0x51: d = c; break;
-			case 0x52: /*d = d;*/ break;
-			case 0x53: d = e; break;
-			case 0x54: d = h; break;
-			case 0x55: d = l; break;
-			case 0x56: READ(d, hl()); break;
-			case 0x57: d = a; break;
-
-			case 0x58: e = b; break;
-			case 0x59: e = c; break;
-			case 0x5A: e = d; break;
-			case 0x5B: /*e = e;*/ break;
-			case 0x5C: e = h; break;
-			case 0x5D: e = l; break;
-			case 0x5E: READ(e, hl()); break;
-			case 0x5F: e = a; break;
-
-			case 0x60: h = b; break;
-			case 0x61: h = c; break;
-			case 0x62: h = d; break;
-			case 0x63: h = e; break;
-			case 0x64: /*h = h;*/ break;
-			case 0x65: h = l; break;
-			case 0x66: READ(h, hl()); break;
-			case 0x67: h = a; break;
-
-			case 0x68: l = b; break;
-			case 0x69: l = c; break;
-			case 0x6A: l = d; break;
-			case 0x6B: l = e; break;
-			case 0x6C: l = h; break;
-			case 0x6D: /*l = l;*/ break;
-			case 0x6E: READ(l, hl()); break;
-			case 0x6F: l = a; break;
-
-			case 0x70: WRITE(hl(), b); break;
-			case 0x71: WRITE(hl(), c); break;
-			case 0x72: WRITE(hl(), d); break;
-			case 0x73: WRITE(hl(), e); break;
-			case 0x74: WRITE(hl(), h); break;
-			case 0x75: WRITE(hl(), l); break;
+				NEXT_OPCODE;
+
+			OPCODE(0x40): /*b = b;*/ NEXT_OPCODE;
+			OPCODE(0x41): b = c; NEXT_OPCODE;
+			OPCODE(0x42): b = d; NEXT_OPCODE;
+			OPCODE(0x43): b = e; NEXT_OPCODE;
+			OPCODE(0x44): b = h; NEXT_OPCODE;
+			OPCODE(0x45): b = l; NEXT_OPCODE;
+			OPCODE(0x46): READ(b, hl()); NEXT_OPCODE;
+			OPCODE(0x47): b = a; NEXT_OPCODE;
+
+			OPCODE(0x48): c = b; NEXT_OPCODE;
+			OPCODE(0x49): /*c = c;*/ NEXT_OPCODE;
+			OPCODE(0x4A): c = d; NEXT_OPCODE;
+			OPCODE(0x4B): c = e; NEXT_OPCODE;
+			OPCODE(0x4C): c = h; NEXT_OPCODE;
+			OPCODE(0x4D): c = l; NEXT_OPCODE;
+			OPCODE(0x4E): READ(c, hl()); NEXT_OPCODE;
+			OPCODE(0x4F): c = a; NEXT_OPCODE;
+
+			OPCODE(0x50): d = b; NEXT_OPCODE;
+			OPCODE(0x51): d = c; NEXT_OPCODE;
+			OPCODE(0x52): /*d = d;*/ NEXT_OPCODE;
+			OPCODE(0x53): d = e; NEXT_OPCODE;
+			OPCODE(0x54): d = h; NEXT_OPCODE;
+			OPCODE(0x55): d = l; NEXT_OPCODE;
+			OPCODE(0x56): READ(d, hl()); NEXT_OPCODE;
+			OPCODE(0x57): d = a; NEXT_OPCODE;
+
+			OPCODE(0x58): e = b; NEXT_OPCODE;
+			OPCODE(0x59): e = c; NEXT_OPCODE;
+			OPCODE(0x5A): e = d; NEXT_OPCODE;
+			OPCODE(0x5B): /*e = e;*/ NEXT_OPCODE;
+			OPCODE(0x5C): e = h; NEXT_OPCODE;
+			OPCODE(0x5D): e = l; NEXT_OPCODE;
+			OPCODE(0x5E): READ(e, hl()); NEXT_OPCODE;
+			OPCODE(0x5F): e = a; NEXT_OPCODE;
+
+			OPCODE(0x60): h = b; NEXT_OPCODE;
+			OPCODE(0x61): h = c; NEXT_OPCODE;
+			OPCODE(0x62): h = d; NEXT_OPCODE;
+			OPCODE(0x63): h = e; NEXT_OPCODE;
+			OPCODE(0x64): /*h = h;*/ NEXT_OPCODE;
+			OPCODE(0x65): h = l; NEXT_OPCODE;
+			OPCODE(0x66): READ(h, hl()); NEXT_OPCODE;
+			OPCODE(0x67): h = a; NEXT_OPCODE;
+
+			OPCODE(0x68): l = b; NEXT_OPCODE;
+			OPCODE(0x69): l = c; NEXT_OPCODE;
+			OPCODE(0x6A): l = d; NEXT_OPCODE;
+			OPCODE(0x6B): l = e; NEXT_OPCODE;
+			OPCODE(0x6C): l = h; NEXT_OPCODE;
+			OPCODE(0x6D): /*l = l;*/ NEXT_OPCODE;
+			OPCODE(0x6E): READ(l, hl()); NEXT_OPCODE;
+			OPCODE(0x6F): l = a; NEXT_OPCODE;
+
+			OPCODE(0x70): WRITE(hl(), b); NEXT_OPCODE;
+			OPCODE(0x71): WRITE(hl(), c); NEXT_OPCODE;
+			OPCODE(0x72): WRITE(hl(), d); NEXT_OPCODE;
+			OPCODE(0x73): WRITE(hl(), e); NEXT_OPCODE;
+			OPCODE(0x74): WRITE(hl(), h); NEXT_OPCODE;
+			OPCODE(0x75): WRITE(hl(), l); NEXT_OPCODE;
 
 				// halt (4 cycles):
-			case 0x76:
+			OPCODE(0x76):
 				if (!mem_.ime()
 					&& (   mem_.ff_read(0x0F, cycleCounter)
 					     & mem_.ff_read(0xFF, cycleCounter) & 0x1F)) {
@@ -1012,6 +1270,7 @@ void CPU::process(unsigned long const cycles) {
 						skip_ = true;
 				} else {
 					mem_.halt();
+					CATCH_HALT(false, catch_halt, 1);
 
 					if (cycleCounter < mem_.nextEventTime()) {
 						unsigned long cycles = mem_.nextEventTime() - cycleCounter;
@@ -1019,130 +1278,132 @@ void CPU::process(unsigned long const cycles) {
 					}
 				}
 
-				break;
-
-			case 0x77: WRITE(hl(), a); break;
-			case 0x78: a = b; break;
-			case 0x79: a = c; break;
-			case 0x7A: a = d; break;
-			case 0x7B: a = e; break;
-			case 0x7C: a = h; break;
-			case 0x7D: a = l; break;
-			case 0x7E: READ(a, hl()); break;
-			case 0x7F: /*a = a;*/ break;
-
-			case 0x80: add_a_u8(b); break;
-			case 0x81: add_a_u8(c); break;
-			case 0x82: add_a_u8(d); break;
-			case 0x83: add_a_u8(e); break;
-			case 0x84: add_a_u8(h); break;
-			case 0x85: add_a_u8(l); break;
-			case 0x86: { unsigned data; READ(data, hl()); add_a_u8(data); } break;
-			case 0x87: add_a_u8(a); break;
-
-			case 0x88: adc_a_u8(b); break;
-			case 0x89: adc_a_u8(c); break;
-			case 0x8A: adc_a_u8(d); break;
-			case 0x8B: adc_a_u8(e); break;
-			case 0x8C: adc_a_u8(h); break;
-			case 0x8D: adc_a_u8(l); break;
-			case 0x8E: { unsigned data; READ(data, hl()); adc_a_u8(data); } break;
-			case 0x8F: adc_a_u8(a); break;
-
-			case 0x90: sub_a_u8(b); break;
-			case 0x91: sub_a_u8(c); break;
-			case 0x92: sub_a_u8(d); break;
-			case 0x93: sub_a_u8(e); break;
-			case 0x94: sub_a_u8(h); break;
-			case 0x95: sub_a_u8(l); break;
-			case 0x96: { unsigned data; READ(data, hl()); sub_a_u8(data); } break;
+				NEXT_OPCODE;
+
+			OPCODE(0x77): WRITE(hl(), a); NEXT_OPCODE;
+			OPCODE(0x78): a = b; NEXT_OPCODE;
+			OPCODE(0x79): a = c; NEXT_OPCODE;
+			OPCODE(0x7A): a = d; NEXT_OPCODE;
+			OPCODE(0x7B): a = e; NEXT_OPCODE;
+			OPCODE(0x7C): a = h; NEXT_OPCODE;
+			OPCODE(0x7D): a = l; NEXT_OPCODE;
+			OPCODE(0x7E): READ(a, hl()); NEXT_OPCODE;
+			OPCODE(0x7F): /*a = a;*/ NEXT_OPCODE;
+
+			OPCODE(0x80): add_a_u8(b); NEXT_OPCODE;
+			OPCODE(0x81): add_a_u8(c); NEXT_OPCODE;
+			OPCODE(0x82): add_a_u8(d); NEXT_OPCODE;
+			OPCODE(0x83): add_a_u8(e); NEXT_OPCODE;
+			OPCODE(0x84): add_a_u8(h); NEXT_OPCODE;
+			OPCODE(0x85): add_a_u8(l); NEXT_OPCODE;
+			OPCODE(0x86): { unsigned data; READ(data, hl()); add_a_u8(data); } NEXT_OPCODE;
+			OPCODE(0x87): add_a_u8(a); NEXT_OPCODE;
+
+			OPCODE(0x88): adc_a_u8(b); NEXT_OPCODE;
+			OPCODE(0x89): adc_a_u8(c); NEXT_OPCODE;
+			OPCODE(0x8A): adc_a_u8(d); NEXT_OPCODE;
+			OPCODE(0x8B): adc_a_u8(e); NEXT_OPCODE;
+			OPCODE(0x8C): adc_a_u8(h); NEXT_OPCODE;
+			OPCODE(0x8D): adc_a_u8(l); NEXT_OPCODE;
+			OPCODE(0x8E): { unsigned data; READ(data, hl()); adc_a_u8(data); } NEXT_OPCODE;
+			OPCODE(0x8F): adc_a_u8(a); NEXT_OPCODE;
+
+			OPCODE(0x90): sub_a_u8(b); NEXT_OPCODE;
+			OPCODE(0x91): sub_a_u8(c); NEXT_OPCODE;
+			OPCODE(0x92): sub_a_u8(d); NEXT_OPCODE;
+			OPCODE(0x93): sub_a_u8(e); NEXT_OPCODE;
+			OPCODE(0x94): sub_a_u8(h); NEXT_OPCODE;
+			OPCODE(0x95): sub_a_u8(l); NEXT_OPCODE;
+			OPCODE(0x96): { unsigned data; READ(data, hl()); sub_a_u8(data); } NEXT_OPCODE;
 
 				// A-A is always 0:
-			case 0x97:
+			OPCODE(0x97):
 				hf2 = hf2_subf;
 				cf = zf = a = 0;
-				break;
-
-			case 0x98: sbc_a_u8(b); break;
-			case 0x99: sbc_a_u8(c); break;
-			case 0x9A: sbc_a_u8(d); break;
-			case 0x9B: sbc_a_u8(e); break;
-			case 0x9C: sbc_a_u8(h); break;
-			case 0x9D: sbc_a_u8(l); break;
-			case 0x9E: { unsigned data; READ(data, hl()); sbc_a_u8(data); } break;
-			case 0x9F: sbc_a_u8(a); break;
-
-			case 0xA0: and_a_u8(b); break;
-			case 0xA1: and_a_u8(c); break;
-			case 0xA2: and_a_u8(d); break;
-			case 0xA3: and_a_u8(e); break;
-			case 0xA4: and_a_u8(h); break;
-			case 0xA5: and_a_u8(l); break;
-			case 0xA6: { unsigned data; READ(data, hl()); and_a_u8(data); } break;
+				NEXT_OPCODE;
+
+			OPCODE(0x98): sbc_a_u8(b); NEXT_OPCODE;
+			OPCODE(0x99): sbc_a_u8(c); NEXT_OPCODE;
+			OPCODE(0x9A): sbc_a_u8(d); NEXT_OPCODE;
+			OPCODE(0x9B): sbc_a_u8(e); NEXT_OPCODE;
+			OPCODE(0x9C): sbc_a_u8(h); NEXT_OPCODE;
+			OPCODE(0x9D): sbc_a_u8(l); NEXT_OPCODE;
+			OPCODE(0x9E): { unsigned data; READ(data, hl()); sbc_a_u8(data); } NEXT_OPCODE;
+			OPCODE(0x9F): sbc_a_u8(a); NEXT_OPCODE;
+
+			OPCODE(0xA0): and_a_u8(b); NEXT_OPCODE;
+			OPCODE(0xA1): and_a_u8(c); NEXT_OPCODE;
+			OPCODE(0xA2): and_a_u8(d); NEXT_OPCODE;
+			OPCODE(0xA3): and_a_u8(e); NEXT_OPCODE;
+			OPCODE(0xA4): and_a_u8(h); NEXT_OPCODE;
+			OPCODE(0xA5): and_a_u8(l); NEXT_OPCODE;
+			OPCODE(0xA6): { unsigned data; READ(data, hl()); and_a_u8(data); } NEXT_OPCODE;
 
 				// A&A will always be A:
-			case 0xA7:
+			OPCODE(0xA7):
 				zf = a;
 				cf = 0;
 				hf2 = hf2_hcf;
-				break;
+				NEXT_OPCODE;
 
-			case 0xA8: xor_a_u8(b); break;
-			case 0xA9: xor_a_u8(c); break;
-			case 0xAA: xor_a_u8(d); break;
-			case 0xAB: xor_a_u8(e); break;
-			case 0xAC: xor_a_u8(h); break;
-			case 0xAD: xor_a_u8(l); break;
-			case 0xAE: { unsigned data; READ(data, hl()); xor_a_u8(data); } break;
+			OPCODE(0xA8): xor_a_u8(b); NEXT_OPCODE;
+			OPCODE(0xA9): xor_a_u8(c); NEXT_OPCODE;
+			OPCODE(0xAA): xor_a_u8(d); NEXT_OPCODE;
+			OPCODE(0xAB): xor_a_u8(e); NEXT_OPCODE;
+			OPCODE(0xAC): xor_a_u8(h); NEXT_OPCODE;
+			OPCODE(0xAD): xor_a_u8(l); NEXT_OPCODE;
+			OPCODE(0xAE): { unsigned data; READ(data, hl()); xor_a_u8(data); } NEXT_OPCODE;
 
 				// A^A will always be 0:
-			case 0xAF: cf = hf2 = zf = a = 0; break;
+			OPCODE(0xAF): cf = hf2 = zf = a = 0; NEXT_OPCODE;
 
-			case 0xB0: or_a_u8(b); break;
-			case 0xB1: or_a_u8(c); break;
-			case 0xB2: or_a_u8(d); break;
-			case 0xB3: or_a_u8(e); break;
-			case 0xB4: or_a_u8(h); break;
-			case 0xB5: or_a_u8(l); break;
-			case 0xB6: { unsigned data; READ(data, hl()); or_a_u8(data); } break;
+			OPCODE(0xB0): or_a_u8(b); NEXT_OPCODE;
+			OPCODE(0xB1): or_a_u8(c); NEXT_OPCODE;
+			OPCODE(0xB2): or_a_u8(d); NEXT_OPCODE;
+			OPCODE(0xB3): or_a_u8(e); NEXT_OPCODE;
+			OPCODE(0xB4): or_a_u8(h); NEXT_OPCODE;
+			OPCODE(0xB5): or_a_u8(l); NEXT_OPCODE;
+			OPCODE(0xB6): { unsigned data; READ(data, hl()); or_a_u8(data); } NEXT_OPCODE;
 
 				// A|A will always be A:
-			case 0xB7:
+			OPCODE(0xB7):
 				zf = a;
 				hf2 = cf = 0;
-				break;
+				NEXT_OPCODE;
 
-			case 0xB8: cp_a_u8(b); break;
-			case 0xB9: cp_a_u8(c); break;
-			case 0xBA: cp_a_u8(d); break;
-			case 0xBB: cp_a_u8(e); break;
-			case 0xBC: cp_a_u8(h); break;
-			case 0xBD: cp_a_u8(l); break;
-			case 0xBE: { unsigned data; READ(data, hl()); cp_a_u8(data); } break;
+			OPCODE(0xB8): cp_a_u8(b); NEXT_OPCODE;
+			OPCODE(0xB9): cp_a_u8(c); NEXT_OPCODE;
+			OPCODE(0xBA): cp_a_u8(d); NEXT_OPCODE;
+			OPCODE(0xBB): cp_a_u8(e); NEXT_OPCODE;
+			OPCODE(0xBC): cp_a_u8(h); NEXT_OPCODE;
+			OPCODE(0xBD): cp_a_u8(l); NEXT_OPCODE;
+			OPCODE(0xBE): { unsigned data; READ(data, hl()); cp_a_u8(data); } NEXT_OPCODE;
 
 				// A always equals A:
-			case 0xBF:
+			OPCODE(0xBF):
 				cf = zf = 0;
 				hf2 = hf2_subf;
-				break;
+				NEXT_OPCODE;
 
 				// ret nz (20;8 cycles):
 				// Pop two bytes from the stack and jump to that address, if ZF is unset:
-			case 0xC0:
+			OPCODE(0xC0):
 				cycleCounter += 4;
 
 				if (zf & 0xFF)
 					ret();
+				else
+					COVER_EDGE(pc);
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xC1:
+			OPCODE(0xC1):
 				pop_rr(b, c);
-				break;
+				NEXT_OPCODE;
 
 				// jp nz,nn (16;12 cycles):
 				// Jump to address stored in next two bytes in memory if ZF is unset:
-			case 0xC2:
+			OPCODE(0xC2):
 				if (zf & 0xFF) {
 					jp_nn();
 				} else {
@@ -1150,16 +1411,16 @@ void CPU::process(unsigned long const cycles) {
 					cycleCounter += 4;
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xC3:
+			OPCODE(0xC3):
 				jp_nn();
-				break;
+				NEXT_OPCODE;
 
 				// call nz,nn (24;12 cycles):
 				// Push address of next instruction onto stack and then jump to
 				// address stored in next two bytes in memory, if ZF is unset:
-			case 0xC4:
+			OPCODE(0xC4):
 				if (zf & 0xFF) {
 					call_nn();
 				} else {
@@ -1167,43 +1428,45 @@ void CPU::process(unsigned long const cycles) {
 					cycleCounter += 4;
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xC5:
+			OPCODE(0xC5):
 				push_rr(b, c);
-				break;
-			case 0xC6:
+				NEXT_OPCODE;
+			OPCODE(0xC6):
 				{
 					unsigned data;
 					PC_READ(data);
 					add_a_u8(data);
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xC7:
+			OPCODE(0xC7):
 				rst_n(0x00);
-				break;
+				NEXT_OPCODE;
 
 				// ret z (20;8 cycles):
 				// Pop two bytes from the stack and jump to that address, if ZF is set:
-			case 0xC8:
+			OPCODE(0xC8):
 				cycleCounter += 4;
 
 				if (!(zf & 0xFF))
 					ret();
+				else
+					COVER_EDGE(pc);
 
-				break;
+				NEXT_OPCODE;
 
 				// ret (16 cycles):
 				// Pop two bytes from the stack and jump to that address:
-			case 0xC9:
+			OPCODE(0xC9):
 				ret();
-				break;
+				NEXT_OPCODE;
 
 				// jp z,nn (16;12 cycles):
 				// Jump to address stored in next two bytes in memory if ZF is set:
-			case 0xCA:
+			OPCODE(0xCA):
 				if (zf & 0xFF) {
 					PC_MOD((pc + 2) & 0xFFFF);
 					cycleCounter += 4;
@@ -1211,12 +1474,13 @@ void CPU::process(unsigned long const cycles) {
 					jp_nn();
 				}
 
-				break;
+				NEXT_OPCODE;
 
 
 				// CB OPCODES (Shifts, rotates and bits):
-			case 0xCB:
+			OPCODE(0xCB):
 				PC_READ(opcode);
+				PROFILE(++mem_.profile().cbOpcodes[opcode]);
 
 				switch (opcode) {
 				case 0x00: rlc_r(b); break;
@@ -1627,13 +1891,13 @@ void CPU::process(unsigned long const cycles) {
 				case 0xFF: set7_r(a); break;
 				}
 
-				break;
+				NEXT_OPCODE;
 
 
 				// call z,nn (24;12 cycles):
 				// Push address of next instruction onto stack and then jump to
 				// address stored in next two bytes in memory, if ZF is set:
-			case 0xCC:
+			OPCODE(0xCC):
 				if (zf & 0xFF) {
 					PC_MOD((pc + 2) & 0xFFFF);
 					cycleCounter += 4;
@@ -1641,42 +1905,44 @@ void CPU::process(unsigned long const cycles) {
 					call_nn();
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xCD:
+			OPCODE(0xCD):
 				call_nn();
-				break;
+				NEXT_OPCODE;
 
-			case 0xCE:
+			OPCODE(0xCE):
 				{
 					unsigned data;
 					PC_READ(data);
 					adc_a_u8(data);
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xCF:
+			OPCODE(0xCF):
 				rst_n(0x08);
-				break;
+				NEXT_OPCODE;
 
 				// ret nc (20;8 cycles):
 				// Pop two bytes from the stack and jump to that address, if CF is unset:
-			case 0xD0:
+			OPCODE(0xD0):
 				cycleCounter += 4;
 
 				if (!(cf & 0x100))
 					ret();
+				else
+					COVER_EDGE(pc);
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xD1:
+			OPCODE(0xD1):
 				pop_rr(d, e);
-				break;
+				NEXT_OPCODE;
 
 				// jp nc,nn (16;12 cycles):
 				// Jump to address stored in next two bytes in memory if CF is unset:
-			case 0xD2:
+			OPCODE(0xD2):
 				if (cf & 0x100) {
 					PC_MOD((pc + 2) & 0xFFFF);
 					cycleCounter += 4;
@@ -1684,15 +1950,15 @@ void CPU::process(unsigned long const cycles) {
 					jp_nn();
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xD3: // not specified. should freeze.
-				break;
+			OPCODE(0xD3): // not specified. should freeze.
+				NEXT_OPCODE;
 
 				// call nc,nn (24;12 cycles):
 				// Push address of next instruction onto stack and then jump to
 				// address stored in next two bytes in memory, if CF is unset:
-			case 0xD4:
+			OPCODE(0xD4):
 				if (cf & 0x100) {
 					PC_MOD((pc + 2) & 0xFFFF);
 					cycleCounter += 4;
@@ -1700,38 +1966,40 @@ void CPU::process(unsigned long const cycles) {
 					call_nn();
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xD5:
+			OPCODE(0xD5):
 				push_rr(d, e);
-				break;
+				NEXT_OPCODE;
 
-			case 0xD6:
+			OPCODE(0xD6):
 				{
 					unsigned data;
 					PC_READ(data);
 					sub_a_u8(data);
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xD7:
+			OPCODE(0xD7):
 				rst_n(0x10);
-				break;
+				NEXT_OPCODE;
 
 				// ret c (20;8 cycles):
 				// Pop two bytes from the stack and jump to that address, if CF is set:
-			case 0xD8:
+			OPCODE(0xD8):
 				cycleCounter += 4;
 
 				if (cf & 0x100)
 					ret();
+				else
+					COVER_EDGE(pc);
 
-				break;
+				NEXT_OPCODE;
 
 				// reti (16 cycles):
 				// Pop two bytes from the stack and jump to that address, then enable interrupts:
-			case 0xD9:
+			OPCODE(0xD9):
 				{
 					unsigned sl, sh;
 					pop_rr(sh, sl);
@@ -1739,11 +2007,11 @@ void CPU::process(unsigned long const cycles) {
 					PC_MOD(sh << 8 | sl);
 				}
 
-				break;
+				NEXT_OPCODE;
 
 				// jp c,nn (16;12 cycles):
 				// Jump to address stored in next two bytes in memory if CF is set:
-			case 0xDA:
+			OPCODE(0xDA):
 				if (cf & 0x100) {
 					jp_nn();
 				} else {
@@ -1751,15 +2019,15 @@ void CPU::process(unsigned long const cycles) {
 					cycleCounter += 4;
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xDB: // not specified. should freeze.
-				break;
+			OPCODE(0xDB): // not specified. should freeze.
+				NEXT_OPCODE;
 
 				// call z,nn (24;12 cycles):
 				// Push address of next instruction onto stack and then jump to
 				// address stored in next two bytes in memory, if CF is set:
-			case 0xDC:
+			OPCODE(0xDC):
 				if (cf & 0x100) {
 					call_nn();
 				} else {
@@ -1767,81 +2035,84 @@ void CPU::process(unsigned long const cycles) {
 					cycleCounter += 4;
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xDE:
+			OPCODE(0xDD): // not specified. should freeze.
+				NEXT_OPCODE;
+			OPCODE(0xDE):
 				{
 					unsigned data;
 					PC_READ(data);
 					sbc_a_u8(data);
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xDF:
+			OPCODE(0xDF):
 				rst_n(0x18);
-				break;
+				NEXT_OPCODE;
 
 				// ld ($FF00+n),a (12 cycles):
 				// Put value in A into address (0xFF00 + next byte in memory):
-			case 0xE0:
+			OPCODE(0xE0):
 				{
 					unsigned imm;
 					PC_READ(imm);
 					FF_WRITE(imm, a);
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xE1:
+			OPCODE(0xE1):
 				pop_rr(h, l);
-				break;
+				NEXT_OPCODE;
 
 				// ld ($FF00+C),a (8 ycles):
 				// Put A into address (0xFF00 + register C):
-			case 0xE2:
+			OPCODE(0xE2):
 				FF_WRITE(c, a);
-				break;
+				NEXT_OPCODE;
 
-			case 0xE3: // not specified. should freeze.
-				break;
-			case 0xE4: // not specified. should freeze.
-				break;
+			OPCODE(0xE3): // not specified. should freeze.
+				NEXT_OPCODE;
+			OPCODE(0xE4): // not specified. should freeze.
+				NEXT_OPCODE;
 
-			case 0xE5:
+			OPCODE(0xE5):
 				push_rr(h, l);
-				break;
+				NEXT_OPCODE;
 
-			case 0xE6:
+			OPCODE(0xE6):
 				{
 					unsigned data;
 					PC_READ(data);
 					and_a_u8(data);
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xE7:
+			OPCODE(0xE7):
 				rst_n(0x20);
-				break;
+				NEXT_OPCODE;
 
 				// add sp,n (16 cycles):
 				// Add next (signed) byte in memory to SP, reset ZF and SF, check HCF and CF:
-			case 0xE8:
+			OPCODE(0xE8):
 				sp_plus_n(sp);
 				cycleCounter += 4;
-				break;
+				NEXT_OPCODE;
 
 				// jp hl (4 cycles):
 				// Jump to address in hl:
-			case 0xE9:
+			OPCODE(0xE9):
 				pc = hl();
-				break;
+				COVER_EDGE(pc);
+				NEXT_OPCODE;
 
 				// ld (nn),a (16 cycles):
 				// set memory at address given by the next 2 bytes to value in A:
 				// Incrementing PC before call, because of possible interrupt.
-			case 0xEA:
+			OPCODE(0xEA):
 				{
 					unsigned imml, immh;
 					PC_READ(imml);
@@ -1849,40 +2120,40 @@ void CPU::process(unsigned long const cycles) {
 					WRITE(immh << 8 | imml, a);
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xEB: // not specified. should freeze.
-				break;
-			case 0xEC: // not specified. should freeze.
-				break;
-			case 0xED: // not specified. should freeze.
-				break;
+			OPCODE(0xEB): // not specified. should freeze.
+				NEXT_OPCODE;
+			OPCODE(0xEC): // not specified. should freeze.
+				NEXT_OPCODE;
+			OPCODE(0xED): // not specified. should freeze.
+				NEXT_OPCODE;
 
-			case 0xEE:
+			OPCODE(0xEE):
 				{
 					unsigned data;
 					PC_READ(data);
 					xor_a_u8(data);
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xEF:
+			OPCODE(0xEF):
 				rst_n(0x28);
-				break;
+				NEXT_OPCODE;
 
 				// ld a,($FF00+n) (12 cycles):
 				// Put value at address (0xFF00 + next byte in memory) into A:
-			case 0xF0:
+			OPCODE(0xF0):
 				{
 					unsigned imm;
 					PC_READ(imm);
 					FF_READ(a, imm);
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xF1:
+			OPCODE(0xF1):
 				{
 					unsigned F;
 					pop_rr(a, F);
@@ -1891,23 +2162,23 @@ void CPU::process(unsigned long const cycles) {
 					cf  =  cfFromF(F);
 				}
 
-				break;
+				NEXT_OPCODE;
 
 				// ld a,($FF00+C) (8 cycles):
 				// Put value at address (0xFF00 + register C) into A:
-			case 0xF2:
+			OPCODE(0xF2):
 				FF_READ(a, c);
-				break;
+				NEXT_OPCODE;
 
 				// di (4 cycles):
-			case 0xF3:
+			OPCODE(0xF3):
 				mem_.di();
-				break;
+				NEXT_OPCODE;
 
-			case 0xF4: // not specified. should freeze.
-				break;
+			OPCODE(0xF4): // not specified. should freeze.
+				NEXT_OPCODE;
 
-			case 0xF5:
+			OPCODE(0xF5):
 				hf2 = updateHf2FromHf1(hf1, hf2);
 
 				{
@@ -1915,24 +2186,24 @@ void CPU::process(unsigned long const cycles) {
 					push_rr(a, F);
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xF6:
+			OPCODE(0xF6):
 				{
 					unsigned data;
 					PC_READ(data);
 					or_a_u8(data);
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xF7:
+			OPCODE(0xF7):
 				rst_n(0x30);
-				break;
+				NEXT_OPCODE;
 
 				// ldhl sp,n (12 cycles):
 				// Put (sp+next (signed) byte in memory) into hl (unsets ZF and SF, may enable HF and CF):
-			case 0xF8:
+			OPCODE(0xF8):
 				{
 					unsigned sum;
 					sp_plus_n(sum);
@@ -1940,18 +2211,18 @@ void CPU::process(unsigned long const cycles) {
 					h = sum >> 8;
 				}
 
-				break;
+				NEXT_OPCODE;
 
 				// ld sp,hl (8 cycles):
 				// Put value in HL into SP
-			case 0xF9:
+			OPCODE(0xF9):
 				sp = hl();
 				cycleCounter += 4;
-				break;
+				NEXT_OPCODE;
 
 				// ld a,(nn) (16 cycles):
 				// set A to value in memory at address given by the 2 next bytes.
-			case 0xFA:
+			OPCODE(0xFA):
 				{
 					unsigned imml, immh;
 					PC_READ(imml);
@@ -1960,19 +2231,19 @@ void CPU::process(unsigned long const cycles) {
 					READ(a, immh << 8 | imml);
 				}
 
-				break;
+				NEXT_OPCODE;
 
 				// ei (4 cycles):
 				// Enable Interrupts after next instruction:
-			case 0xFB:
+			OPCODE(0xFB):
 				mem_.ei(cycleCounter);
-				break;
+				NEXT_OPCODE;
 
-			case 0xFC: // not specified. should freeze.
-				break;
-			case 0xFD: // not specified. should freeze
-				break;
-			case 0xFE:
+			OPCODE(0xFC): // not specified. should freeze.
+				NEXT_OPCODE;
+			OPCODE(0xFD): // not specified. should freeze
+				NEXT_OPCODE;
+			OPCODE(0xFE):
 				{
 					unsigned data;
 					PC_READ(data);
@@ -1980,20 +2251,22 @@ void CPU::process(unsigned long const cycles) {
 					cp_a_u8(data);
 				}
 
-				break;
+				NEXT_OPCODE;
 
-			case 0xFF:
+			OPCODE(0xFF):
 				rst_n(0x38);
-				break;
+				NEXT_OPCODE;
 			}
 		}
 
 		pc_ = pc;
 		cycleCounter = mem_.event(cycleCounter);
+		idleLoop_.end = 0;
 	}
 
 	a_ = a;
 	cycleCounter_ = cycleCounter;
+	idleLoopCycles_ += cycleCounter - start;
 }
 
 }
@@ -37,6 +37,9 @@ public:
 	void setStatePtrs(SaveState &state);
 	void saveState(SaveState &state);
 	void loadState(SaveState const &state);
+
+	// Flags register as the program would see it.
+	unsigned f() const;
 #if 0
 	void loadSavedata() { mem_.loadSavedata(); }
 	void saveSavedata() { mem_.saveSavedata(); }
@@ -95,6 +98,21 @@ public:
 		mem_.setDmgPaletteColor(palNum, colorNum, rgb32);
 	}
 
+	// size must be a power of two; 0 turns edge coverage off.
+	void setCoverage(unsigned char *map, std::size_t size) { mem_.setCoverage(map, size); }
+	void clearCoveragePath() { mem_.clearCoveragePath(); }
+
+	// Fast-forwards short polling loops that can only change state at the
+	// next event. Skipped cycles are counted against the cycles run.
+	void setIdleLoopSkip(bool enable) { idleLoopSkip_ = enable; }
+	unsigned long long idleLoopCycles() const { return idleLoopCycles_; }
+	unsigned long long idleLoopSkipped() const { return idleLoopSkipped_; }
+	void clearIdleLoopStats() { idleLoopCycles_ = idleLoopSkipped_ = 0; }
+
+	// Picks the threaded dispatch or the plain switch, where the build has
+	// both (GAMBATTE_DIFFTEST). False if the other one is all there is.
+	bool setThreadedDispatch(bool enable);
+
 	void setGameGenie(std::string const &codes) { mem_.setGameGenie(codes); }
 	void setGameShark(std::string const &codes) { mem_.setGameShark(codes); }
 
@@ -111,6 +129,25 @@ public:
 private:
 	bool skip_;
 
+	// Registers as of the last taken backward jr, to spot a loop that came
+	// back around in the same state. Forgotten at every event.
+	struct IdleLoop {
+		unsigned target, end;
+		unsigned long cc;
+		unsigned regs[12];
+		bool checked, idle;
+	};
+
+	bool idleLoopSkip_;
+	bool threadedDispatch_;
+	IdleLoop idleLoop_;
+	unsigned long long idleLoopCycles_;
+	unsigned long long idleLoopSkipped_;
+
+	unsigned long skipIdleLoop(unsigned target, unsigned end, unsigned a, unsigned long cc);
+	bool isIdleLoopBody(unsigned target, unsigned end) const;
+
+	template<bool debug, bool coverage, bool threaded>
 	void process(unsigned long cycles);
 };
 
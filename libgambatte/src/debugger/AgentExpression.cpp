@@ -0,0 +1,218 @@
+
+#include "AgentExpression.h"
+#include "Debugger.h"
+#include "cpu.h"
+
+#include <utility>
+
+
+namespace gambatte {
+namespace debugger {
+
+namespace {
+
+/// Opcodes from gdb's ax.def; the trace ones only when collecting.
+enum Op : uint8_t {
+    op_add = 0x02,
+    op_sub = 0x03,
+    op_mul = 0x04,
+    op_div_signed = 0x05,
+    op_div_unsigned = 0x06,
+    op_rem_signed = 0x07,
+    op_rem_unsigned = 0x08,
+    op_lsh = 0x09,
+    op_rsh_signed = 0x0a,
+    op_rsh_unsigned = 0x0b,
+    op_trace = 0x0c,
+    op_trace_quick = 0x0d,
+    op_log_not = 0x0e,
+    op_bit_and = 0x0f,
+    op_bit_or = 0x10,
+    op_bit_xor = 0x11,
+    op_bit_not = 0x12,
+    op_equal = 0x13,
+    op_less_signed = 0x14,
+    op_less_unsigned = 0x15,
+    op_ext = 0x16,
+    op_ref8 = 0x17,
+    op_ref16 = 0x18,
+    op_ref32 = 0x19,
+    op_ref64 = 0x1a,
+    op_if_goto = 0x20,
+    op_goto = 0x21,
+    op_const8 = 0x22,
+    op_const16 = 0x23,
+    op_const32 = 0x24,
+    op_const64 = 0x25,
+    op_reg = 0x26,
+    op_end = 0x27,
+    op_dup = 0x28,
+    op_pop = 0x29,
+    op_zero_ext = 0x2a,
+    op_swap = 0x2b,
+    op_trace16 = 0x30,
+    op_pick = 0x32,
+    op_rot = 0x33
+};
+
+const size_t kStackSize = 64;
+const size_t kMaxSteps = 10000;
+
+}
+
+AgentExpression::AgentExpression(std::vector<uint8_t> bytecode) : bytecode(bytecode)
+{
+    
+}
+
+bool AgentExpression::Evaluate(Debugger& debugger, int64_t& result, const Collector& collect) const
+{
+    int64_t stack[kStackSize];
+    size_t sp = 0;
+    size_t pc = 0;
+    CPU* cpu = debugger.cpu;
+    
+    auto read_memory = [cpu](uint64_t address, int bytes) {
+        uint64_t value = 0;
+        for (int i = bytes - 1; i >= 0; i--) {
+            // peek, not read: evaluation must not disturb I/O registers.
+            value = value << 8 | cpu->mem_.peek((address + i) & 0xffff);
+        }
+        return value;
+    };
+    
+    // Immediate operands are big endian.
+    auto immediate = [this, &pc](size_t bytes, uint64_t& out) {
+        if (pc + bytes > bytecode.size()) return false;
+        out = 0;
+        for (size_t i = 0; i < bytes; i++) {
+            out = out << 8 | bytecode[pc++];
+        }
+        return true;
+    };
+    
+#define NEED(n) do { if (sp < (n)) return false; } while (0)
+#define PUSH(v) do { if (sp == kStackSize) return false; stack[sp++] = (v); } while (0)
+    
+    for (size_t steps = 0; steps < kMaxSteps; steps++) {
+        if (pc >= bytecode.size()) return false;
+        uint8_t op = bytecode[pc++];
+        uint64_t imm;
+        int64_t a, b;
+        switch (op) {
+            case op_add: NEED(2); b = stack[--sp]; stack[sp - 1] += b; break;
+            case op_sub: NEED(2); b = stack[--sp]; stack[sp - 1] -= b; break;
+            case op_mul: NEED(2); b = stack[--sp]; stack[sp - 1] *= b; break;
+            case op_div_signed:
+                NEED(2); b = stack[--sp];
+                if (b == 0 || (b == -1 && stack[sp - 1] == INT64_MIN)) return false;
+                stack[sp - 1] /= b;
+                break;
+            case op_div_unsigned:
+                NEED(2); b = stack[--sp];
+                if (b == 0) return false;
+                stack[sp - 1] = (uint64_t)stack[sp - 1] / (uint64_t)b;
+                break;
+            case op_rem_signed:
+                NEED(2); b = stack[--sp];
+                if (b == 0 || (b == -1 && stack[sp - 1] == INT64_MIN)) return false;
+                stack[sp - 1] %= b;
+                break;
+            case op_rem_unsigned:
+                NEED(2); b = stack[--sp];
+                if (b == 0) return false;
+                stack[sp - 1] = (uint64_t)stack[sp - 1] % (uint64_t)b;
+                break;
+            case op_lsh: NEED(2); b = stack[--sp]; stack[sp - 1] = (uint64_t)stack[sp - 1] << (b & 63); break;
+            case op_rsh_signed: NEED(2); b = stack[--sp]; stack[sp - 1] >>= (b & 63); break;
+            case op_rsh_unsigned: NEED(2); b = stack[--sp]; stack[sp - 1] = (uint64_t)stack[sp - 1] >> (b & 63); break;
+            case op_log_not: NEED(1); stack[sp - 1] = !stack[sp - 1]; break;
+            case op_bit_and: NEED(2); b = stack[--sp]; stack[sp - 1] &= b; break;
+            case op_bit_or: NEED(2); b = stack[--sp]; stack[sp - 1] |= b; break;
+            case op_bit_xor: NEED(2); b = stack[--sp]; stack[sp - 1] ^= b; break;
+            case op_bit_not: NEED(1); stack[sp - 1] = ~stack[sp - 1]; break;
+            case op_equal: NEED(2); b = stack[--sp]; stack[sp - 1] = stack[sp - 1] == b; break;
+            case op_less_signed: NEED(2); b = stack[--sp]; stack[sp - 1] = stack[sp - 1] < b; break;
+            case op_less_unsigned: NEED(2); b = stack[--sp]; stack[sp - 1] = (uint64_t)stack[sp - 1] < (uint64_t)b; break;
+            case op_ext:
+            case op_zero_ext:
+                NEED(1);
+                if (!immediate(1, imm)) return false;
+                if (imm < 64) {
+                    uint64_t mask = (1ull << imm) - 1;
+                    uint64_t value = stack[sp - 1] & mask;
+                    if (op == op_ext && imm > 0 && (value >> (imm - 1) & 1)) value |= ~mask;
+                    stack[sp - 1] = value;
+                }
+                break;
+            case op_ref8: NEED(1); stack[sp - 1] = read_memory(stack[sp - 1], 1); break;
+            case op_ref16: NEED(1); stack[sp - 1] = read_memory(stack[sp - 1], 2); break;
+            case op_ref32: NEED(1); stack[sp - 1] = read_memory(stack[sp - 1], 4); break;
+            case op_ref64: NEED(1); stack[sp - 1] = read_memory(stack[sp - 1], 8); break;
+            case op_if_goto:
+                NEED(1);
+                if (!immediate(2, imm)) return false;
+                if (stack[--sp] != 0) pc = imm;
+                break;
+            case op_goto:
+                if (!immediate(2, imm)) return false;
+                pc = imm;
+                break;
+            case op_const8: if (!immediate(1, imm)) return false; PUSH(imm); break;
+            case op_const16: if (!immediate(2, imm)) return false; PUSH(imm); break;
+            case op_const32: if (!immediate(4, imm)) return false; PUSH(imm); break;
+            case op_const64: if (!immediate(8, imm)) return false; PUSH(imm); break;
+            case op_reg:
+                if (!immediate(2, imm) || imm >= Debugger::Registers.size()) return false;
+                PUSH(Debugger::Registers[imm].accessor(cpu));
+                break;
+            case op_end:
+                // Collect actions may leave nothing behind.
+                result = sp ? stack[sp - 1] : 0;
+                return true;
+            case op_trace:
+                NEED(2);
+                if (!collect) return false;
+                b = stack[--sp];
+                a = stack[--sp];
+                collect(a, b);
+                break;
+            case op_trace_quick:
+                NEED(1);
+                if (!collect || !immediate(1, imm)) return false;
+                collect(stack[sp - 1], imm);
+                break;
+            case op_trace16:
+                NEED(1);
+                if (!collect || !immediate(2, imm)) return false;
+                collect(stack[sp - 1], imm);
+                break;
+            case op_dup: NEED(1); a = stack[sp - 1]; PUSH(a); break;
+            case op_pop: NEED(1); sp--; break;
+            case op_swap: NEED(2); std::swap(stack[sp - 1], stack[sp - 2]); break;
+            case op_pick:
+                if (!immediate(1, imm)) return false;
+                NEED(imm + 1);
+                a = stack[sp - 1 - imm];
+                PUSH(a);
+                break;
+            case op_rot:
+                NEED(3);
+                a = stack[sp - 1];
+                stack[sp - 1] = stack[sp - 2];
+                stack[sp - 2] = stack[sp - 3];
+                stack[sp - 3] = a;
+                break;
+            default:
+                return false;
+        }
+    }
+    
+#undef NEED
+#undef PUSH
+    
+    return false;
+}
+
+}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <functional>
+
+namespace gambatte {
+namespace debugger {
+
+class Debugger;
+
+/// Class used to represent a gdb agent expression, as sent in the
+/// cond_list of a Z0 packet or as a tracepoint collect action.
+class AgentExpression {
+    
+public:
+    /// Receives the memory ranges named by the trace opcodes.
+    typedef std::function<void(long address, size_t length)> Collector;
+    
+    AgentExpression(std::vector<uint8_t> bytecode);
+    
+    /// Runs the bytecode against the current cpu state. Returns false
+    /// when the expression is malformed or uses an unsupported opcode;
+    /// the trace opcodes are only supported when `collect` is set.
+    bool Evaluate(Debugger& debugger, int64_t& result, const Collector& collect = Collector()) const;
+    
+    std::vector<uint8_t> bytecode;
+
+private:
+    
+};
+
+}
+}
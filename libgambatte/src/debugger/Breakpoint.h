@@ -1,5 +1,9 @@
 #pragma once
 
+#include "AgentExpression.h"
+
+#include <vector>
+
 namespace gambatte {
 namespace debugger {
 
@@ -12,6 +16,12 @@ public:
     long address;
     long uses;
     bool enabled = true;
+    
+    /// Target-side conditions; the breakpoint fires if any is true.
+    std::vector<AgentExpression> conditions;
+    
+    /// Number of times the breakpoint was reached with its condition met.
+    long hits = 0;
 
 private:
 
@@ -1,13 +1,31 @@
 #include "Debugger.h"
 #include <vector>
+#include <sstream>
+#include <algorithm>
+#include <climits>
+#include <ctime>
+#include <functional>
 #include "GdbConnection.h"
 #include "GdbStub.h"
 #include "cpu.h"
 
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+
 
 namespace gambatte {
 namespace debugger {
 
+static long Banked(CPU* cpu, long address)
+{
+    if (address < 0x4000 || address >= 0x8000) {
+        return address;
+    }
+    return (long)cpu->mem_.rombank() << 16 | address;
+}
+
 std::vector<Debugger::RegisterLayout> Debugger::Registers = {
     {"a", RegisterLayout::RegisterType::integer, [](CPU* cpu){ return cpu->a_; }},
     {"b", RegisterLayout::RegisterType::integer, [](CPU* cpu){ return cpu->b; }},
@@ -15,22 +33,23 @@ std::vector<Debugger::RegisterLayout> Debugger::Registers = {
     {"d", RegisterLayout::RegisterType::integer, [](CPU* cpu){ return cpu->d; }},
     {"e", RegisterLayout::RegisterType::integer, [](CPU* cpu){ return cpu->e; }},
     {"sp", RegisterLayout::RegisterType::data_ptr, [](CPU* cpu){ return cpu->sp; }, 32}, // regnum 5
-    {"pc", RegisterLayout::RegisterType::code_ptr, [](CPU* cpu){ return cpu->correct_pc; }, 32}, // regnum 6
+    {"pc", RegisterLayout::RegisterType::code_ptr, [](CPU* cpu){ return Banked(cpu, cpu->correct_pc); }, 32}, // regnum 6
     {"h", RegisterLayout::RegisterType::integer, [](CPU* cpu){ return cpu->h; }},
     {"l", RegisterLayout::RegisterType::integer, [](CPU* cpu){ return cpu->l; }}
 };
 
-Debugger::Debugger(CPU* cpu) : cpu(cpu)
-{
-    
-}
+static const char* HitReason = "swbreak:;";
+static const char* BudgetReason = "";
+static const char* HistoryBeginReason = "replaylog:begin;";
 
-static void* GdbRun(void* ctx)
+Debugger::Debugger(CPU* cpu) : cpu(cpu), history(cpu)
 {
-    GdbStub* stub = (GdbStub*)ctx;
-    stub->Run();
-    LOG(WARNING) << "GDB stub has exited the run method!";
-    return NULL;
+    if (pipe(command_fds) < 0 || pipe(done_fds) < 0) {
+        LOG(ERROR) << "error creating debugger command pipes";
+    }
+    // A full wake pipe already means a wake-up is pending.
+    fcntl(command_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(command_fds[1], F_SETFL, O_NONBLOCK);
 }
 
 void Debugger::StartGdbStub(std::string address, int port)
@@ -40,106 +59,783 @@ void Debugger::StartGdbStub(std::string address, int port)
         return;
     }
     
-    gdb = new GdbStub(this, address, port);
-    pthread_create(&gdb_thread, NULL, GdbRun, gdb);
+    gdb = GdbStub::Serve(this, address, port);
+}
+
+void Debugger::SetThreadId(int id)
+{
+    std::stringstream keys;
+    keys << std::hex << "thread:p1." << id << ";core:" << id << ";";
+    thread_id = id;
+    thread_keys = keys.str();
+}
+
+StopReason* Debugger::Trap(const std::string& keys, int signal)
+{
+    return new StopReason(StopReason::StopType::signal_extended, signal, keys + thread_keys);
+}
+
+bool Debugger::IsActive()
+{
+    return is_halted || stepping || replaying || budgeted || tracer || tracing || catching || !breakpoints.empty() || !watchpoints.empty() || (gdb != nullptr && gdb->HasConnection());
+}
+
+bool Debugger::StartTrace(const std::string& path, bool delta)
+{
+    StopTrace();
+    std::unique_ptr<Tracer> trace(new Tracer());
+    if (!trace->Start(path, delta)) {
+        return false;
+    }
+    tracer = std::move(trace);
+    return true;
+}
+
+void Debugger::StopTrace()
+{
+    if (tracer) {
+        tracer->Stop();
+        tracer.reset();
+    }
 }
 
 void Debugger::AddBreakpoint(Breakpoint* bp)
 {
-    breakpoints[bp->address].push_back(bp);
+    auto& bps = breakpoints[bp->address];
+    if (bps.empty()) {
+        breakpoint_keys[bp->address & 0xffff]++;
+    }
+    bps.push_back(bp);
+    breakpoint_map[bp->address & 0xffff] |= MapBreakpoint;
 }
 
 void Debugger::RemoveBreakpoint(Breakpoint* bp)
 {
-    auto bps = breakpoints[bp->address];
+    auto entry = breakpoints.find(bp->address);
+    if (entry == breakpoints.end()) {
+        return;
+    }
+    auto& bps = entry->second;
     for (auto iter = bps.begin(); iter != bps.end(); iter++) {
         if (*iter == bp) {
             bps.erase(iter);
+            delete bp;
             break;
         }
     }
+    if (bps.empty()) {
+        long address = entry->first;
+        breakpoints.erase(entry);
+        ReleaseBreakpointKey(address);
+    }
 }
 
 void Debugger::RemoveBreakpoints(long address)
 {
-    breakpoints[address].clear();
+    auto entry = breakpoints.find(address);
+    if (entry == breakpoints.end()) {
+        return;
+    }
+    for (Breakpoint* bp : entry->second) {
+        delete bp;
+    }
+    breakpoints.erase(entry);
+    ReleaseBreakpointKey(address);
+}
+
+void Debugger::ReleaseBreakpointKey(long address)
+{
+    // Banked and unbanked entries share the slot of their 16-bit address.
+    if (--breakpoint_keys[address & 0xffff] == 0) {
+        breakpoint_map[address & 0xffff] &= ~MapBreakpoint;
+    }
+}
+
+void Debugger::ClearTracepoints()
+{
+    StopTracing("tnotrun:0");
+    for (auto& entry : tracepoints) {
+        for (Tracepoint* tp : entry.second) {
+            delete tp;
+        }
+    }
+    tracepoints.clear();
+    if (trace_buffer) {
+        trace_buffer->Clear();
+    }
+    trace_frame = -1;
+}
+
+void Debugger::AddTracepoint(Tracepoint* tp)
+{
+    tracepoints[tp->address].push_back(tp);
+}
+
+Tracepoint* Debugger::FindTracepoint(long number, long address)
+{
+    auto entry = tracepoints.find(address);
+    if (entry == tracepoints.end()) {
+        return nullptr;
+    }
+    for (Tracepoint* tp : entry->second) {
+        if (tp->number == number) {
+            return tp;
+        }
+    }
+    return nullptr;
+}
+
+void Debugger::StartTracing()
+{
+    if (!trace_buffer) {
+        trace_buffer.reset(new TraceBuffer(1 << 20));
+    }
+    trace_buffer->Clear();
+    trace_frame = -1;
+    for (auto& entry : tracepoints) {
+        for (Tracepoint* tp : entry.second) {
+            tp->hits = 0;
+        }
+    }
+    tracing = true;
+    trace_stop_reason = "";
+    for (auto& entry : tracepoints) {
+        breakpoint_map[entry.first & 0xffff] |= MapTracepoint;
+    }
+}
+
+void Debugger::StopTracing(std::string reason)
+{
+    if (!tracing) {
+        return;
+    }
+    tracing = false;
+    trace_stop_reason = reason;
+    for (auto& entry : tracepoints) {
+        breakpoint_map[entry.first & 0xffff] &= ~MapTracepoint;
+    }
+}
+
+void Debugger::CollectTracepoints(long address)
+{
+    auto collect = [&](long key) {
+        auto entry = tracepoints.find(key);
+        if (entry == tracepoints.end()) {
+            return;
+        }
+        for (Tracepoint* tp : entry->second) {
+            if (tracing && tp->enabled && ConditionHolds(tp->conditions, address)) {
+                Collect(tp);
+            }
+        }
+    };
+    collect(address);
+    if (address >= 0x4000 && address < 0x8000) {
+        collect(BankedAddress(address));
+    }
+}
+
+void Debugger::Collect(Tracepoint* tp)
+{
+    TraceBuffer& buffer = *trace_buffer;
+    bool fits = buffer.BeginFrame(tp->number);
+    
+    if (fits) {
+        // The pc is always kept so gdb can place the frame.
+        uint32_t values[32];
+        size_t count = std::min(Registers.size(), (size_t)32);
+        uint32_t mask = tp->registers | 1u << PcRegister;
+        for (size_t i = 0; i < count; i++) {
+            values[i] = (mask >> i & 1) ? Registers[i].accessor(cpu) : 0;
+        }
+        fits = buffer.AddRegisters(mask, values, count);
+    }
+    
+    uint8_t bytes[0x100];
+    auto add_memory = [&](long address, size_t length) {
+        while (fits && length > 0) {
+            size_t chunk = std::min(length, sizeof(bytes));
+            chunk = PeekLiveMemory(address, chunk, bytes);
+            if (chunk == 0) {
+                return;
+            }
+            fits = buffer.AddMemory(address, bytes, chunk);
+            address += chunk;
+            length -= chunk;
+        }
+    };
+    for (const Tracepoint::MemoryRange& range : tp->memory) {
+        long base = range.base_register < 0 ? 0 : Registers[range.base_register].accessor(cpu);
+        long address = base + range.offset;
+        // Register-relative ranges wrap on the bus; absolute ones may be banked.
+        add_memory(range.base_register < 0 ? address : address & 0xffff, range.length);
+    }
+    for (const AgentExpression& expression : tp->expressions) {
+        int64_t result;
+        if (!expression.Evaluate(*this, result, add_memory)) {
+            LOG(WARNING) << "Could not evaluate collect action of tracepoint " << tp->number;
+        }
+    }
+    
+    buffer.EndFrame(fits);
+    if (!fits) {
+        StopTracing("tfull:0");
+        return;
+    }
+    
+    tp->hits++;
+    if (tp->pass_count > 0 && tp->hits >= tp->pass_count) {
+        std::stringstream reason;
+        reason << "tpasscount:" << std::hex << tp->number;
+        StopTracing(reason.str());
+    }
+}
+
+void Debugger::AddWatchpoint(Watchpoint* wp)
+{
+    watchpoints.push_back(wp);
+    UpdateWatchedAreas();
+}
+
+void Debugger::RemoveWatchpoint(long address, size_t length, Watchpoint::Type type)
+{
+    for (auto iter = watchpoints.begin(); iter != watchpoints.end(); iter++) {
+        Watchpoint* wp = *iter;
+        if (wp->address == address && wp->length == length && wp->type == type) {
+            watchpoints.erase(iter);
+            delete wp;
+            break;
+        }
+    }
+    UpdateWatchedAreas();
+}
+
+void Debugger::UpdateWatchedAreas()
+{
+    unsigned read_areas = 0;
+    unsigned write_areas = 0;
+    for (Watchpoint* wp : watchpoints) {
+        if (wp->length == 0) continue;
+        unsigned areas = 0;
+        // Banked ROM addresses watch the 4K areas of the bank window.
+        long first = wp->address & 0xffff;
+        long last = std::min(first + (long)wp->length - 1, 0xffffL);
+        for (long area = first >> 12; area <= last >> 12; area++) {
+            areas |= 1u << area;
+        }
+        if (wp->type != Watchpoint::Type::write) read_areas |= areas;
+        if (wp->type != Watchpoint::Type::read) write_areas |= areas;
+    }
+    cpu->mem_.setWatchedAreas(read_areas, write_areas);
+}
+
+void Debugger::CheckForWatchpoints(long address, bool write)
+{
+    // Accesses made while stopped come from gdb itself.
+    if (is_halted) {
+        return;
+    }
+    long banked = BankedAddress(address);
+    for (Watchpoint* wp : watchpoints) {
+        long hit = wp->Matches(address, write) ? address
+                 : wp->Matches(banked, write) ? banked
+                 : -1;
+        if (hit >= 0) {
+            std::stringstream additional;
+            additional << wp->StopKey() << ":" << std::hex << hit << ";";
+            if (replaying) {
+                // The access belongs to the instruction counted last.
+                if (replay_scan && position - 1 < replay_target) {
+                    scan_found = true;
+                    scan_hit = position - 1;
+                    scan_reason = additional.str();
+                    scan_message.clear();
+                }
+                return;
+            }
+            Halt(Trap(additional.str())); // 5: SIGTRAP
+            return;
+        }
+    }
+}
+
+static const char* InterruptNames[] = { "VBlank", "STAT", "Timer", "Serial", "Joypad" };
+
+bool Debugger::SetCatchpoint(const std::string& event, long argument, bool enable)
+{
+    if (event == "interrupt") {
+        // argument is an IF bit mask; -1 for all of them
+        uint8_t mask = argument < 0 ? 0x1f : argument & 0x1f;
+        catch_interrupts = enable ? catch_interrupts | mask : catch_interrupts & ~mask;
+    } else if (event == "halt") {
+        catch_halt = enable;
+    } else if (event == "stop") {
+        catch_stop = enable;
+    } else if (event == "bank") {
+        catch_bank = enable;
+    } else if (event == "io" && argument >= 0) {
+        catch_io[argument & 0xff] = enable;
+    } else if (event == "io" && !enable) {
+        memset(catch_io, 0, sizeof(catch_io));
+    } else {
+        return false;
+    }
+    catching = catch_interrupts || catch_halt || catch_stop || catch_bank ||
+               std::any_of(catch_io, catch_io + 0x100, [](bool armed) { return armed; });
+    return true;
+}
+
+std::string Debugger::DescribeCatchpoints()
+{
+    std::stringstream description;
+    for (int i = 0; i < 5; i++) {
+        if (catch_interrupts >> i & 1) {
+            description << "interrupt " << InterruptNames[i] << std::endl;
+        }
+    }
+    if (catch_halt) description << "halt" << std::endl;
+    if (catch_stop) description << "stop" << std::endl;
+    if (catch_bank) description << "bank" << std::endl;
+    for (int i = 0; i < 0x100; i++) {
+        if (catch_io[i]) {
+            description << "io 0x" << std::hex << (0xff00 | i) << std::dec << std::endl;
+        }
+    }
+    return description.str();
+}
+
+void Debugger::CatchInterrupt(unsigned bit, unsigned address)
+{
+    std::stringstream message;
+    int index = 0;
+    while (index < 4 && !(bit >> index & 1)) index++;
+    message << "Catchpoint: " << InterruptNames[index] << " interrupt, jumping to 0x"
+            << std::hex << address;
+    CatchHit(message.str());
+}
+
+void Debugger::CatchHalt(bool stop, unsigned address)
+{
+    std::stringstream message;
+    message << "Catchpoint: " << (stop ? "STOP" : "HALT") << " at 0x" << std::hex << address;
+    CatchHit(message.str());
+}
+
+void Debugger::CatchBankSwitch(unsigned address, unsigned data, unsigned old_bank, unsigned new_bank, bool rom)
+{
+    std::stringstream message;
+    message << "Catchpoint: " << (rom ? "ROM" : "RAM") << " bank " << std::hex;
+    if (rom) {
+        message << "0x" << old_bank << " -> 0x" << new_bank;
+    } else {
+        message << "mapping changed";
+    }
+    message << " by writing 0x" << data << " to 0x" << address;
+    CatchHit(message.str());
 }
 
-void Debugger::CheckForBreakpoints(long address)
+void Debugger::CatchIoWrite(unsigned reg, unsigned old_value, unsigned data)
 {
-    auto bps = breakpoints[address];
+    std::stringstream message;
+    message << std::hex << "Catchpoint: 0x" << data << " written to 0x" << (0xff00 | reg)
+            << " (was 0x" << old_value << ")";
+    CatchHit(message.str());
+}
+
+void Debugger::CatchHit(const std::string& message)
+{
+    // Events caused by gdb itself, or while a stop is already pending, are
+    // not reported.
+    if (is_halted) {
+        return;
+    }
+    if (replaying) {
+        // The cpu stops before the next instruction, at `position`.
+        if (replay_scan && position < replay_target) {
+            scan_found = true;
+            scan_hit = position;
+            scan_reason = "";
+            scan_message = message;
+        }
+        return;
+    }
+    StopReason* reason = Trap(""); // 5: SIGTRAP
+    reason->message = message;
+    Halt(reason);
+}
+
+void Debugger::SetStepRange(long start, long end)
+{
+    step_range = std::make_tuple(start, end);
+    stepping = start != -1;
+}
+
+void Debugger::HandleBreakpointHit(long address)
+{
+    if ((breakpoint_map[address & 0xffff] & MapTracepoint) && !replaying) {
+        CollectTracepoints(address);
+    }
+    
     bool suitable_bp = false;
     std::vector<Breakpoint*> to_remove;
-    if (bps.size() > 0) {
-        for (Breakpoint* bp : bps) {
-            if (bp->enabled) {
+    auto check = [&](long key) {
+        auto entry = breakpoints.find(key);
+        if (entry == breakpoints.end()) {
+            return;
+        }
+        for (Breakpoint* bp : entry->second) {
+            if (bp->enabled && ConditionHolds(bp->conditions, bp->address)) {
                 suitable_bp = true;
+                // Replayed hits already happened once.
+                if (replaying) continue;
+                bp->hits++;
                 if (bp->uses > 1) bp->uses--;
                 else if (bp->uses == 1) to_remove.push_back(bp);
             }
         }
+    };
+    check(address);
+    if (address >= 0x4000 && address < 0x8000) {
+        check(BankedAddress(address));
     }
     for (Breakpoint* bp : to_remove) {
         RemoveBreakpoint(bp);
     }
-    if (std::get<0>(step_range) != -1) {
-        if (!(std::get<0>(step_range) <= address && address <= std::get<1>(step_range))) {
+    if (stepping) {
+        // Ranges come from gdb, which sees the banked pc.
+        long pc = BankedAddress(address);
+        if (!(std::get<0>(step_range) <= pc && pc <= std::get<1>(step_range))) {
             // Outside of step_range
             suitable_bp = true;
-            step_range = std::make_tuple(-1, -1);
+            SetStepRange(-1, -1);
         }
     }
-    if (suitable_bp) {
-        Halt(new StopReason(StopReason::StopType::signal_extended, 5, "swbreak:;thread:p1.1;core:1;")); // 5: SIGTRAP
+    if (replaying) {
+        ReplayReached(suitable_bp, HitReason);
+    } else if (suitable_bp) {
+        Halt(Trap(HitReason)); // 5: SIGTRAP
+    } else if (budgeted && cpu->cycleCounter_ >= budget_end) {
+        Halt(Trap(BudgetReason)); // 5: SIGTRAP
+    }
+}
+
+void Debugger::RunBudget(unsigned long cycles, unsigned long frames)
+{
+    budgeted = true;
+    budget_start = cpu->cycleCounter_;
+    budget_frames = frames;
+    budget_end = frames != 0 ? ULONG_MAX : budget_start + cycles;
+    Unhalt();
+}
+
+bool Debugger::EndBudget(unsigned long& elapsed)
+{
+    bool spent = budget_frames == 0 && cpu->cycleCounter_ >= budget_end;
+    elapsed = cpu->cycleCounter_ - budget_start;
+    budgeted = false;
+    budget_frames = 0;
+    return spent;
+}
+
+void Debugger::RebaseBudget(unsigned long old_cc, unsigned long new_cc)
+{
+    unsigned long delta = old_cc - new_cc;
+    budget_start -= delta;
+    if (budget_frames == 0) {
+        budget_end = budget_end > delta ? budget_end - delta : 0;
+    }
+}
+
+void Debugger::ReverseStep()
+{
+    uint64_t start;
+    if (position == 0 || !history.Find(position - 1, start)) {
+        Halt(Trap(HistoryBeginReason));
+        return;
+    }
+    scan_reason = HitReason;
+    scan_message.clear();
+    StartReplay(position - 1, false);
+}
+
+void Debugger::ReverseContinue()
+{
+    uint64_t start;
+    if (position == 0 || !history.Find(position - 1, start)) {
+        Halt(Trap(HistoryBeginReason));
+        return;
     }
+    StartReplay(position, true);
+}
+
+void Debugger::RecordHistory()
+{
+    if (!history.IsRecording()) {
+        return;
+    }
+    if (replaying) {
+        // Keep what the restored snapshot was taken with.
+        history.Record(position, history.Input(), history.Clock());
+    } else {
+        history.Record(position, cpu->mem_.pollInput(), std::time(0));
+    }
+}
+
+void Debugger::StartReplay(uint64_t target, bool scan)
+{
+    replay_target = target;
+    replay_scan = scan;
+    scan_found = false;
+    rewind_pending = true;
+    SetStepRange(-1, -1);
+    Unhalt();
+}
+
+void Debugger::Rewind()
+{
+    rewind_pending = false;
+    
+    // A scan covers [snapshot, target) and so restores strictly before it.
+    uint64_t restored;
+    uint64_t from = replay_scan ? replay_target - 1 : replay_target;
+    if (!history.Restore(from, restored)) {
+        replaying = false;
+        Halt(Trap(HistoryBeginReason));
+        return;
+    }
+    position = restored;
+    scan_start = restored;
+    replaying = true;
+}
+
+void Debugger::ReplayReached(bool hit, const std::string& reason)
+{
+    if (position < replay_target) {
+        if (replay_scan && hit) {
+            scan_found = true;
+            scan_hit = position;
+            scan_reason = reason;
+            scan_message.clear();
+        }
+        return;
+    }
+    
+    replaying = false;
+    if (!replay_scan) {
+        StopReason* reason = Trap(scan_reason); // 5: SIGTRAP
+        reason->message = scan_message;
+        Halt(reason);
+        return;
+    }
+    
+    uint64_t earlier;
+    if (scan_found) {
+        // Run the segment once more, stopping at its last hit.
+        StartReplay(scan_hit, false);
+    } else if (scan_start > 0 && history.Find(scan_start - 1, earlier)) {
+        // Nothing in this segment; scan the one before it.
+        StartReplay(scan_start, true);
+    } else {
+        scan_reason = HistoryBeginReason;
+        scan_message.clear();
+        StartReplay(history.Count() ? history.Oldest() : position, false);
+    }
+}
+
+bool Debugger::ConditionHolds(const std::vector<AgentExpression>& conditions, long address)
+{
+    if (conditions.empty()) {
+        return true;
+    }
+    for (const AgentExpression& condition : conditions) {
+        int64_t result;
+        if (!condition.Evaluate(*this, result)) {
+            LOG(WARNING) << "Could not evaluate condition at " << address << ", treating it as true";
+            return true;
+        }
+        if (result != 0) {
+            return true;
+        }
+    }
+    return false;
 }
 
 void Debugger::Halt(StopReason* reason)
 {
-    is_halted = true;
     stop_reason = reason;
+    is_halted = true;
     if (gdb != nullptr) gdb->NotifyHalted(reason);
 }
 
 void Debugger::Unhalt()
 {
-    is_halted = false;
     stop_reason = nullptr;
-    is_halted_cond.notify_all();
+    is_halted = false;
 }
 
-void Debugger::WaitWhileHalted()
+void Debugger::WaitForUnhalt()
 {
-    if (is_halted) {
-        std::unique_lock<std::mutex> lk(is_halted_mutex);
-        is_halted_cond.wait(lk, [this]{ return !this->is_halted; });
+    while (is_halted) {
+        RunCommands();
+        if (!is_halted) {
+            break;
+        }
+        struct pollfd fd = { command_fds[0], POLLIN, 0 };
+        if (poll(&fd, 1, -1) < 0 && errno != EINTR) {
+            LOG(ERROR) << "poll failed while halted: " << errno;
+            return;
+        }
+        char wake[64];
+        while (read(command_fds[0], wake, sizeof(wake)) > 0) {}
+    }
+}
+
+void Debugger::Execute(std::function<void()> command)
+{
+    while (!commands.Push(std::move(command))) {
+        usleep(100);
+    }
+    char wake = 1;
+    write(command_fds[1], &wake, sizeof(wake));
+    
+    // Whoever holds `machine` drains the queue. When nobody does, the
+    // emulation thread is outside this instance's core: the frontend is
+    // idle, or it is stopped in another instance on the same thread (as in
+    // DUAL_MODE), and would never get to the command. Run it here instead.
+    for (;;) {
+        if (machine.try_lock()) {
+            RunCommands();
+            machine.unlock();
+        }
+        struct pollfd fd = { done_fds[0], POLLIN, 0 };
+        int ready = poll(&fd, 1, ExecuteWaitMs);
+        if (ready < 0 && errno != EINTR) {
+            LOG(ERROR) << "poll failed while executing: " << errno;
+            return;
+        }
+        char done;
+        if (ready > 0 && read(done_fds[0], &done, sizeof(done)) == sizeof(done)) {
+            return;
+        }
+    }
+}
+
+void Debugger::RunCommands()
+{
+    std::function<void()> command;
+    while (commands.Pop(command)) {
+        command();
+        char done = 1;
+        write(done_fds[1], &done, sizeof(done));
     }
 }
 
 void Debugger::EncodeRegisters(util::Buffer &buffer)
 {
+    if (trace_frame >= 0) {
+        // Registers the tracepoint did not collect are unavailable.
+        for (size_t i = 0; i < Registers.size(); i++) {
+            uint32_t value;
+            if (trace_buffer->FrameRegister(trace_frame, i, value)) {
+                GdbConnection::Encode(value, Registers[i].bitsize / 8, buffer, false);
+            } else {
+                std::string unavailable(Registers[i].bitsize / 4, 'x');
+                buffer.Write(unavailable);
+            }
+        }
+        return;
+    }
     for (Debugger::RegisterLayout layout : Debugger::Registers) {
         GdbConnection::Encode(layout.accessor(cpu), layout.bitsize / 8, buffer, false);
     }
 }
 
-void Debugger::EncodeMemory(util::Buffer &buffer, long address, size_t bytes)
+long Debugger::BankedAddress(long address)
+{
+    return Banked(cpu, address);
+}
+
+void Debugger::EncodeStopRegisters(util::Buffer &buffer)
+{
+    const RegisterLayout& pc = Registers[PcRegister];
+    GdbConnection::Encode(PcRegister, 1, buffer);
+    buffer.Write(':');
+    GdbConnection::Encode(pc.accessor(cpu), pc.bitsize / 8, buffer, false);
+    buffer.Write(';');
+}
+
+size_t Debugger::PeekMemory(long address, size_t bytes, uint8_t* out)
+{
+    if (trace_frame >= 0) {
+        return trace_buffer->FrameMemory(trace_frame, address, bytes, out);
+    }
+    return PeekLiveMemory(address, bytes, out);
+}
+
+size_t Debugger::PeekLiveMemory(long address, size_t bytes, uint8_t* out)
 {
-    // Outside of gameboy memory!
     if (address > 0xffff) {
-        return;
+        // bank * 0x10000 + 0x4000..0x7fff
+        long offset = address & 0xffff;
+        if (offset < 0x4000 || offset >= 0x8000) {
+            return 0;
+        }
+        bytes = std::min(bytes, (size_t)(0x8000 - offset));
+        return cpu->mem_.peekRombank(out, address >> 16, offset, bytes) ? bytes : 0;
     }
-    for (int i = 0; i < bytes; i++) {
-        uint8_t byte = cpu->mem_.read(address+i, cpu->cycleCounter_);
-        GdbConnection::Encode(byte, 1, buffer);
+    // Outside of gameboy memory!
+    if (address < 0) {
+        return 0;
     }
+    bytes = std::min(bytes, (size_t)(0x10000 - address));
+    cpu->mem_.peek(out, address, bytes);
+    return bytes;
 }
 
-void Debugger::WriteMemory(long address, size_t size, util::Buffer& buffer)
+bool Debugger::SearchMemory(long address, size_t length, const std::vector<uint8_t>& pattern, long& found)
 {
-    // Outside of gameboy memory!
-    if (address > 0xffff) {
-        return;
+    if (pattern.empty() || length < pattern.size()) {
+        return false;
+    }
+    // PeekMemory stops at the end of the address space or ROM bank window,
+    // so a single read covers everything that can match.
+    std::vector<uint8_t> data(std::min(length, (size_t)0x10000));
+    data.resize(PeekMemory(address, data.size(), data.data()));
+    
+    std::boyer_moore_horspool_searcher<std::vector<uint8_t>::const_iterator> searcher(pattern.begin(), pattern.end());
+    auto match = std::search(data.cbegin(), data.cend(), searcher);
+    if (match == data.cend()) {
+        return false;
+    }
+    found = address + (match - data.cbegin());
+    return true;
+}
+
+std::vector<MemoryScan::Region> Debugger::ScanRegions()
+{
+    const Memory& mem = cpu->mem_;
+    std::vector<MemoryScan::Region> regions;
+    regions.push_back({"wram", mem.wramdata(), mem.wramsize(), 0x1000, 0xc000, 0xd000});
+    if (mem.sramsize()) {
+        regions.push_back({"sram", mem.sramdata(), mem.sramsize(), 0x2000, 0xa000, 0xa000});
+    }
+    regions.push_back({"hram", mem.hramdata(), 0x7f, 0x7f, 0xff80, 0xff80});
+    return regions;
+}
+
+void Debugger::EncodeMemory(util::Buffer &buffer, long address, size_t bytes)
+{
+    bytes = std::min(bytes, GdbConnection::max_memory_read);
+    std::vector<uint8_t> data(bytes);
+    size_t read = PeekMemory(address, bytes, data.data());
+    GdbConnection::Encode(data.data(), read, buffer);
+}
+
+bool Debugger::WriteMemory(long address, size_t size, util::Buffer& buffer)
+{
+    // Outside of gameboy memory, or a banked ROM address, which is read-only.
+    if (address < 0 || address + size > 0x10000) {
+        return false;
     }
     std::vector<uint8_t> bytes;
     GdbConnection::Decode(bytes, buffer);
@@ -148,6 +844,7 @@ void Debugger::WriteMemory(long address, size_t size, util::Buffer& buffer)
         if (i < bytes.size()) byte = bytes.at(i);
         cpu->mem_.write(address+i, byte, cpu->cycleCounter_);
     }
+    return true;
 }
 
 
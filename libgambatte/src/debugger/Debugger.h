@@ -3,14 +3,22 @@
 #include "Buffer.h"
 #include "StopReason.h"
 #include "Breakpoint.h"
+#include "Watchpoint.h"
+#include "Tracepoint.h"
+#include "SpscQueue.h"
+#include "History.h"
+#include "Tracer.h"
+#include "MemoryScan.h"
 
 #include <string.h>
 #include <pthread.h>
 #include <unordered_map>
 #include <vector>
-#include <condition_variable>
-#include <mutex>
+#include <atomic>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
 
 namespace gambatte {
 
@@ -41,44 +49,303 @@ public:
     
 #pragma mark Methods
     
-    /// Start the gdb stub in a separate thread.
+    /// Serve this instance over gdb. Instances started on the same address
+    /// and port share one stub thread, each showing up as its own thread.
     void StartGdbStub(std::string address = "0.0.0.0", int port = 55555);
     
+    /// Called by the stub; `thread_id` tags every stop reply.
+    void SetThreadId(int id);
+    int ThreadId() const { return thread_id; }
+    
+    /// A SIGTRAP (or `signal`) stop with the `keys` stop reply fields.
+    StopReason* Trap(const std::string& keys, int signal = 5);
+    
+    /// True while a gdb client is attached or anything could stop the CPU.
+    /// The CPU only runs its instrumented loop when this holds.
+    bool IsActive();
+    
     void AddBreakpoint(Breakpoint* bp);
     void RemoveBreakpoint(Breakpoint* bp);
     void RemoveBreakpoints(long address);
     
-    void CheckForBreakpoints(long address);
+    void AddWatchpoint(Watchpoint* wp);
+    void RemoveWatchpoint(long address, size_t length, Watchpoint::Type type);
+    
+    /// Called from the memory slow paths for accesses to trapped pages.
+    void CheckForWatchpoints(long address, bool write);
+    
+    /// Arms or disarms a catchpoint: "interrupt" (argument: IF bit mask,
+    /// or -1 for all), "halt", "stop", "bank" or "io" (argument: register
+    /// offset from 0xff00; -1 with enable false clears them all).
+    bool SetCatchpoint(const std::string& event, long argument, bool enable);
+    std::string DescribeCatchpoints();
+    
+    /// Called from the interrupt dispatch, HALT/STOP, MBC and FFxx write
+    /// paths when the matching catchpoint is armed. The cpu stops at the
+    /// next instruction boundary.
+    void CatchInterrupt(unsigned bit, unsigned address);
+    void CatchHalt(bool stop, unsigned address);
+    void CatchBankSwitch(unsigned address, unsigned data, unsigned old_bank, unsigned new_bank, bool rom);
+    void CatchIoWrite(unsigned reg, unsigned old_value, unsigned data);
+    
+    /// Halt as soon as the pc leaves [start, end].
+    void SetStepRange(long start, long end);
+    
+    /// QTinit: forget all tracepoints and collected frames.
+    void ClearTracepoints();
+    void AddTracepoint(Tracepoint* tp);
+    Tracepoint* FindTracepoint(long number, long address);
+    
+    /// QTStart/QTStop. `reason` is the qTStatus stop reason, e.g. "tstop:0".
+    void StartTracing();
+    void StopTracing(std::string reason);
+    
+    /// Called by the CPU before every opcode. Only the flat map is
+    /// consulted here; the breakpoint objects are touched on a hit.
+    void CheckForBreakpoints(long address)
+    {
+        if (breakpoint_map[address & 0xffff] | stepping | replaying | budgeted) {
+            HandleBreakpointHit(address);
+        }
+    }
+    void HandleBreakpointHit(long address);
+    
+    /// Step back one instruction, or continue backwards to the previous
+    /// breakpoint or watchpoint hit. Both replay forward from the newest
+    /// usable snapshot in `history`; called through Execute while halted.
+    void ReverseStep();
+    void ReverseContinue();
+    
+    /// True once a reverse command has unhalted the CPU; it then leaves
+    /// its loop so runFor can call Rewind.
+    bool RewindPending() const { return rewind_pending; }
+    void Rewind();
     
+    /// Called by runFor before the instrumented loop. Samples the joypad
+    /// and the wall clock for `history`, except while replaying.
+    void RecordHistory();
+    
+    /// Called by the CPU for every instruction it is about to execute.
+    void TraceInstruction()
+    {
+        if (tracer) {
+            tracer->Record(*cpu);
+        }
+    }
+    
+    /// The core moved its cycle counter (counter reset or state load).
+    void CyclesRebased(unsigned long old_cc, unsigned long new_cc)
+    {
+        if (tracer) {
+            tracer->Rebase(old_cc, new_cc);
+        }
+        if (budgeted) {
+            RebaseBudget(old_cc, new_cc);
+        }
+    }
+    
+    /// monitor runcycles/runframes: resume, and halt at the first
+    /// instruction once `cycles` cycles have elapsed or, if `frames` is
+    /// set, once that many frames have been completed. Cycles are cpu
+    /// clocks, twice as many per frame in double speed mode.
+    void RunBudget(unsigned long cycles, unsigned long frames);
+    
+    /// Cancels the budget once the cpu has halted. Returns true if the
+    /// budget was used up, false if something else stopped the cpu first.
+    bool EndBudget(unsigned long& elapsed);
+    
+    /// Called by runFor after every call that completed a video frame.
+    void FrameCompleted()
+    {
+        if (budget_frames != 0 && --budget_frames == 0) {
+            budget_end = 0;
+        }
+    }
+    
+    /// Tracing runs until StopTrace; both go through Execute.
+    bool StartTrace(const std::string& path, bool delta);
+    void StopTrace();
+    
+    /// Safe to call from any thread.
     void Halt(StopReason* reason);
     void Unhalt();
-        
-    void WaitWhileHalted();
+    
+    /// Blocks the emulation thread while halted, running queued commands.
+    void WaitWhileHalted()
+    {
+        if (is_halted.load(std::memory_order_relaxed)) {
+            WaitForUnhalt();
+        }
+    }
+    
+    /// Runs `command` on the emulation thread, at an instruction boundary
+    /// or while halted, and returns once it has completed. Everything the
+    /// gdb thread does to the cpu, memory or breakpoints goes through here.
+    /// If the emulation thread is not inside this instance's core (the
+    /// frontend is paused, or halted in another instance), the command runs
+    /// on the calling thread instead, under `machine`.
+    void Execute(std::function<void()> command);
+    
+    /// Called by the emulation thread to drain the command queue.
+    void ProcessCommands()
+    {
+        if (!commands.Empty()) {
+            RunCommands();
+        }
+    }
     
     void EncodeRegisters(util::Buffer& buffer);
+    /// Addresses in the switchable ROM area are given to gdb as
+    /// bank * 0x10000 + address; breakpoints at such addresses only fire
+    /// while that bank is mapped. Other addresses are returned unchanged.
+    long BankedAddress(long address);
+    
+    /// The banked pc as an expedited "06:value;" pair for T stop replies.
+    void EncodeStopRegisters(util::Buffer& buffer);
+    
+    /// Reads memory without side effects (no I/O register reads, no PPU
+    /// or DMA access restrictions). Returns the number of bytes copied.
+    size_t PeekMemory(long address, size_t bytes, uint8_t* out);
+    /// PeekMemory on the running machine, ignoring `trace_frame`.
+    size_t PeekLiveMemory(long address, size_t bytes, uint8_t* out);
     void EncodeMemory(util::Buffer& buffer, long address, size_t bytes);
     
-    void WriteMemory(long address, size_t size, util::Buffer& buffer);
+    /// qSearch:memory. Looks for `pattern` in [address, address + length),
+    /// through PeekMemory, and sets `found` to the first match.
+    bool SearchMemory(long address, size_t length, const std::vector<uint8_t>& pattern, long& found);
+    
+    /// WRAM (all banks), cartridge RAM (all banks) and HRAM, as seen by
+    /// monitor scan.
+    std::vector<MemoryScan::Region> ScanRegions();
+    
+    /// False, writing nothing, if the range leaves the 16-bit bus.
+    bool WriteMemory(long address, size_t size, util::Buffer& buffer);
     
 #pragma mark Properties
-    StopReason* stop_reason = nullptr;
+    std::atomic<StopReason*> stop_reason{nullptr};
     CPU* cpu = nullptr;
     GdbStub* gdb = nullptr;
     
-    bool is_halted = false;
+    std::atomic<bool> is_halted{false};
+    
+    /// Held by the emulation thread whenever it runs or changes the machine
+    /// (GB::runFor, load, reset, state loads and saves). Whoever holds it
+    /// may drain the command queue.
+    std::mutex machine;
     
     std::unordered_map<long, std::vector<Breakpoint*>> breakpoints;
     
+    std::vector<Watchpoint*> watchpoints;
+    
+    /// Tracepoints by address, keyed like `breakpoints`.
+    std::unordered_map<long, std::vector<Tracepoint*>> tracepoints;
+    
+    /// Frames collected since QTStart; allocated on first use.
+    std::unique_ptr<TraceBuffer> trace_buffer;
+    bool tracing = false;
+    std::string trace_stop_reason = "tnotrun:0";
+    
+    /// Frame chosen with QTFrame, or -1. While set, register and memory
+    /// reads are answered from the frame instead of the live machine.
+    long trace_frame = -1;
+    
+    enum : uint8_t {
+        MapBreakpoint = 1,
+        MapTracepoint = 2  ///< only while tracing
+    };
+    
+    /// MapBreakpoint/MapTracepoint bits for every 16-bit address that has an
+    /// entry in `breakpoints` or `tracepoints`.
+    uint8_t breakpoint_map[0x10000] = {};
+    
+    /// Number of keys in `breakpoints` per 16-bit slot, so that adding or
+    /// removing one updates `breakpoint_map` without a rescan.
+    uint16_t breakpoint_keys[0x10000] = {};
+    
     static std::vector<RegisterLayout> Registers;
+    static constexpr size_t PcRegister = 6; ///< index of "pc" in Registers
     
     std::tuple<long, long> step_range = std::make_tuple(-1, -1);
+    bool stepping = false;
+    
+    /// Armed catchpoints, read directly by the slow paths that raise them.
+    bool catching = false; ///< any of the below
+    uint8_t catch_interrupts = 0;
+    bool catch_halt = false;
+    bool catch_stop = false;
+    bool catch_bank = false;
+    bool catch_io[0x100] = {}; ///< FF80-FFFE never fire: HRAM writes skip the slow path
+    
+    /// Set by RunBudget until EndBudget. The budget ends at cycle counter
+    /// `budget_end`, which stays at its maximum while frames are counted.
+    bool budgeted = false;
+    unsigned long budget_start = 0;
+    unsigned long budget_end = 0;
+    unsigned long budget_frames = 0;
+    
+    /// Instructions executed by the instrumented loop. Snapshots are tagged
+    /// with it and reverse execution replays until it matches a target.
+    uint64_t position = 0;
+    History history;
+    
+    /// Only allocated while a trace is being written.
+    std::unique_ptr<Tracer> tracer;
+    
+    /// monitor scan state; only touched on the emulation thread.
+    MemoryScan scan;
 
 private:
-    pthread_t gdb_thread;
+    void RebaseBudget(unsigned long old_cc, unsigned long new_cc);
+    
+    /// Restores the newest snapshot at or before `target` (at the next
+    /// runFor boundary) and runs forward to it. When `scan` is set, hits
+    /// on the way are only recorded, and the last one becomes the target.
+    void StartReplay(uint64_t target, bool scan);
+    void ReplayReached(bool hit, const std::string& reason);
+    
+    bool replaying = false;
+    bool replay_scan = false;
+    bool rewind_pending = false;
+    uint64_t replay_target = 0;
+    uint64_t scan_start = 0;
+    uint64_t scan_hit = 0;
+    bool scan_found = false;
+    std::string scan_reason;
+    std::string scan_message;
+    
+    /// Halts with `message` as the stop description, or records the hit
+    /// while replaying.
+    void CatchHit(const std::string& message);
+    
+    /// Evaluates target-side conditions; true if there are none.
+    bool ConditionHolds(const std::vector<AgentExpression>& conditions, long address);
+    
+    /// Appends a frame for every tracepoint at `address`.
+    void CollectTracepoints(long address);
+    void Collect(Tracepoint* tp);
+    
+    /// Drops a key of `breakpoints` from the count of its 16-bit slot,
+    /// clearing the slot once no banked or unbanked alias is left.
+    void ReleaseBreakpointKey(long address);
+    
+    /// Routes accesses to pages holding a watchpoint off the MemPtrs fast path.
+    void UpdateWatchedAreas();
+    
+    void WaitForUnhalt();
+    void RunCommands();
+    
+    /// How long Execute waits for a running emulation thread before checking
+    /// whether it has left the core.
+    static const int ExecuteWaitMs = 20;
+    
+    int thread_id = 1;
+    std::string thread_keys = "thread:p1.1;core:1;";
     
-    /// Halt Mutex & condition
-    std::mutex is_halted_mutex;
-    std::condition_variable is_halted_cond;
+    /// Commands from the gdb thread. command_fds wakes a halted emulation
+    /// thread, done_fds reports completion back to Execute.
+    util::SpscQueue<std::function<void()>, 64> commands;
+    int command_fds[2];
+    int done_fds[2];
 };
 
 }
@@ -34,7 +34,7 @@ GdbConnection::GdbConnection(int sockfd) : sockfd(sockfd)
 void GdbConnection::ReadInput()
 {
     std::tuple<uint8_t*, size_t> target = in_buffer.Reserve(RECV_BUF_SIZE);
-    size_t r = read(sockfd, (char*) std::get<0>(target), std::get<1>(target));
+    ssize_t r = read(sockfd, (char*) std::get<0>(target), std::get<1>(target));
     if(r <= 0) {
         SignalError();
     } else {
@@ -115,9 +115,27 @@ util::Buffer *GdbConnection::Process(bool &interrupted) {
 	return nullptr;
 }
 
+bool GdbConnection::ConsumeInterrupt() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while(state == State::WAITING_PACKET_OPEN && in_buffer.ReadAvailable()) {
+		char ch = in_buffer.Read()[0];
+		if(ch != '+' && ch != 0x03) {
+			break;
+		}
+		in_buffer.MarkRead(1);
+		if(ch == 0x03) {
+			return true;
+		}
+	}
+	return false;
+}
+
 void GdbConnection::SendMessage(util::Buffer &buffer, char packet_ident)
 {
     std::unique_lock<std::mutex> lock(mutex);
+    if(!connection_alive) {
+        return; // writing to a closed socket would raise SIGPIPE
+    }
     out_buffer.Write(packet_ident);
     uint8_t checksum = 0;
     char ch;
@@ -171,7 +189,6 @@ void GdbConnection::RespondOk() {
 
 void GdbConnection::Notification(util::Buffer &buffer)
 {
-    sleep(1);
     LOG(DEBUG) << "Sending message: " << buffer.GetString();
     SendMessage(buffer, '%');
 }
@@ -290,11 +307,14 @@ void GdbConnection::Encode(uint64_t n, size_t size, util::Buffer &out_buffer, bo
 }
 
 void GdbConnection::Encode(uint8_t *p, size_t size, util::Buffer &out_buffer) {
+	static const char digits[] = "0123456789abcdef";
+	char *dest = (char*) std::get<0>(out_buffer.Reserve(size * 2));
 	for(size_t i = 0; i < size; i++) {
 		uint8_t n = p[i];
-		out_buffer.Write(EncodeHexNybble((n >> 4) & 0xf));
-		out_buffer.Write(EncodeHexNybble((n >> 0) & 0xf));
+		*(dest++) = digits[(n >> 4) & 0xf];
+		*(dest++) = digits[(n >> 0) & 0xf];
 	}
+	out_buffer.MarkWritten(size * 2);
 }
 
 void GdbConnection::Encode(std::string &string, util::Buffer &out_buffer) {
@@ -37,6 +37,10 @@ class GdbConnection {
 	// Entire buffer should be consumed before calling this again.
 	util::Buffer *Process(bool &interrupted);
 
+	// Takes a ^C waiting between packets, for callers that are in the
+	// middle of handling one and cannot call Process.
+	bool ConsumeInterrupt();
+
 	std::mutex mutex;
 	std::condition_variable error_condvar;
 	
@@ -44,6 +48,9 @@ class GdbConnection {
     
     bool connection_alive = true;
 
+	// Largest 'm'/'x' read, in bytes, whose reply fits the advertised PacketSize.
+	static constexpr size_t max_memory_read = 0x10000;
+
 	static uint8_t DecodeHexByte(char *hex);
 	static uint8_t DecodeHexNybble(char hex);
 	static void DecodeWithSeparator(uint64_t &out, char sep, util::Buffer &packet);
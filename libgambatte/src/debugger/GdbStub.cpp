@@ -26,10 +26,20 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
 #include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
 
 
 namespace gambatte {
@@ -37,11 +47,11 @@ namespace debugger {
 
 #pragma mark Public Methods
 
-GdbStub::GdbStub(Debugger* debugger, std::string address, int port) :
-    debugger(debugger),
+GdbStub::GdbStub(std::string address, int port) :
     address(address),
     port(port),
     xfer_libraries(*this, &GdbStub::XferReadLibraries),
+    xfer_memory_map(*this, &GdbStub::XferReadMemoryMap),
     xfer_features(*this)
 {
 	AddGettableQuery(Query(*this, "Supported", &GdbStub::QueryGetSupported, false));
@@ -49,26 +59,56 @@ GdbStub::GdbStub(Debugger* debugger, std::string address, int port) :
 	AddGettableQuery(Query(*this, "fThreadInfo", &GdbStub::QueryGetFThreadInfo, false));
 	AddGettableQuery(Query(*this, "sThreadInfo", &GdbStub::QueryGetSThreadInfo, false));
 	AddGettableQuery(Query(*this, "ThreadExtraInfo", &GdbStub::QueryGetThreadExtraInfo, false, ','));
-    AddGettableQuery(Query(*this, "TStatu",
-                           &GdbStub::QueryGetTStatus, false));
+	AddGettableQuery(Query(*this, "TStatus", &GdbStub::QueryGetTStatus, false));
+	AddGettableQuery(Query(*this, "TP", &GdbStub::QueryGetTracepointStatus, false));
+	AddGettableQuery(Query(*this, "TfP", &GdbStub::QueryGetEmptyList, false));
+	AddGettableQuery(Query(*this, "TsP", &GdbStub::QueryGetEmptyList, false));
+	AddGettableQuery(Query(*this, "TfV", &GdbStub::QueryGetEmptyList, false));
+	AddGettableQuery(Query(*this, "TsV", &GdbStub::QueryGetEmptyList, false));
 	AddGettableQuery(Query(*this, "Offsets", &GdbStub::QueryGetOffsets, false));
 	AddGettableQuery(Query(*this, "Rcmd", &GdbStub::QueryGetRemoteCommand, false, ','));
 	AddGettableQuery(Query(*this, "Xfer", &GdbStub::QueryXfer, false));
+	AddGettableQuery(Query(*this, "Search", &GdbStub::QueryGetSearch, false, ':'));
 	AddSettableQuery(Query(*this, "StartNoAckMode", &GdbStub::QuerySetStartNoAckMode));
 	AddSettableQuery(Query(*this, "ThreadEvents", &GdbStub::QuerySetThreadEvents));
+	AddSettableQuery(Query(*this, "Tinit", &GdbStub::QuerySetTraceInit, false));
+	AddSettableQuery(Query(*this, "TDP", &GdbStub::QuerySetTracepoint, false));
+	AddSettableQuery(Query(*this, "TDPsrc", &GdbStub::QuerySetIgnored, false));
+	AddSettableQuery(Query(*this, "TDV", &GdbStub::QuerySetIgnored, false));
+	AddSettableQuery(Query(*this, "Tro", &GdbStub::QuerySetIgnored, false));
+	AddSettableQuery(Query(*this, "TBuffer", &GdbStub::QuerySetIgnored, false));
+	AddSettableQuery(Query(*this, "TDisconnected", &GdbStub::QuerySetIgnored, false));
+	AddSettableQuery(Query(*this, "TNotes", &GdbStub::QuerySetIgnored, false));
+	AddSettableQuery(Query(*this, "TStart", &GdbStub::QuerySetTraceStart, false));
+	AddSettableQuery(Query(*this, "TStop", &GdbStub::QuerySetTraceStop, false));
+	AddSettableQuery(Query(*this, "TFrame", &GdbStub::QuerySetTraceFrame, false));
 	AddMultiletterHandler("Attach", &GdbStub::HandleVAttach);
 	AddMultiletterHandler("Cont?", &GdbStub::HandleVContQuery);
 	AddMultiletterHandler("Cont", &GdbStub::HandleVCont);
     AddMultiletterHandler("Stopped", &GdbStub::HandleVStopped);
 	AddXferObject("features", xfer_features);
+	AddXferObject("memory-map", xfer_memory_map);
         
-    AddFeature("PacketSize=8192");
+    AddFeature("PacketSize=20000"); // hex: room for all 64K of memory in one 'm' reply
     AddFeature("swbreak+");
+    AddFeature("ConditionalBreakpoints+");
+    AddFeature("ReverseStep+");
+    AddFeature("ReverseContinue+");
+    AddFeature("ConditionalTracepoints+");
 //        AddFeature("hwbreak+");
+    
+    if (pipe(wake_fds) < 0) {
+        LOG(ERROR) << "error creating wake pipe";
+        wake_fds[0] = wake_fds[1] = -1;
+    } else {
+        fcntl(wake_fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(wake_fds[1], F_SETFL, O_NONBLOCK);
+    }
 }
 
 GdbStub::~GdbStub() {
-    
+    if (wake_fds[0] >= 0) close(wake_fds[0]);
+    if (wake_fds[1] >= 0) close(wake_fds[1]);
 }
 
 void GdbStub::Run() {
@@ -81,7 +121,11 @@ void GdbStub::Run() {
     struct sockaddr_in serv_addr;
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_port = htons(port);
-    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    if (inet_pton(AF_INET, address.c_str(), &serv_addr.sin_addr) != 1) {
+        LOG(ERROR) << "invalid bind address: " << address;
+        close(sockfd);
+        return;
+    }
     
     int enable = 1;
     if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0) {
@@ -94,13 +138,31 @@ void GdbStub::Run() {
         return;
     }
     
-    LOG(INFO) << "Listening on *:" << port << " for incoming connections";
+    LOG(INFO) << "Listening on " << address << ":" << port << " for incoming connections";
     
     listen(sockfd, 5);
 
+    // Only one client is served at a time; halt events that arrive while
+    // nobody is connected are simply drained.
     while (true) {
-        AcceptConnection(sockfd);
+        struct pollfd fds[2] = {
+            { sockfd, POLLIN, 0 },
+            { wake_fds[0], POLLIN, 0 }
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            LOG(ERROR) << "poll failed: " << errno;
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            DrainWakeups();
+        }
+        if (fds[0].revents & POLLIN) {
+            AcceptConnection(sockfd);
+        }
     }
+    
+    close(sockfd);
 }
 
 void GdbStub::AcceptConnection(int sockfd)
@@ -114,24 +176,63 @@ void GdbStub::AcceptConnection(int sockfd)
         return;
     }
     
+    // Acks and replies go out as separate small writes; without this every
+    // round trip (a reverse step, say) waits out the peer's delayed ack.
+    int nodelay = 1;
+    setsockopt(clientfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    
     char* client_addr = inet_ntoa(cli_addr.sin_addr);
     
     LOG(INFO) << "Accepted connection from " << client_addr << ":" << cli_addr.sin_port;
             
-    this->debugger->Halt(StopReason::BPReason);
+    // gdb expects a stopped target when it attaches. Once the first target
+    // stops, the thread running it waits inside that instance; Execute runs
+    // the others' commands here rather than wait for that thread.
+    for (Debugger* target : Targets()) {
+        target->Halt(target->Trap(""));
+        target->Execute([target] { target->history.Start(); });
+    }
+    HaltedTogether();
     
     this->connection = new GdbConnection(clientfd);
+    connected = true;
     
+    // Sleep until either gdb sends something or the emulation thread
+    // signals a halt through the wake pipe.
     while (this->connection->connection_alive) {
-        ConnectionLoop();
+        struct pollfd fds[2] = {
+            { clientfd, POLLIN, 0 },
+            { wake_fds[0], POLLIN, 0 }
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            LOG(ERROR) << "poll failed: " << errno;
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            DrainWakeups();
+            this->Stop();
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            this->connection->ReadInput();
+            ConnectionLoop();
+        }
     }
     
     LOG(INFO) << "Connection from " << client_addr << ":" << cli_addr.sin_port << " died";
     
-    this->debugger->Unhalt();
+    for (Debugger* target : Targets()) {
+        target->Execute([target] {
+            target->history.Stop();
+            target->Unhalt();
+        });
+    }
+    reported.clear();
     
+    connected = false;
     delete this->connection;
     this->connection = nullptr;
+    close(clientfd);
 }
 
 void GdbStub::ConnectionLoop()
@@ -172,6 +273,12 @@ void GdbStub::ConnectionLoop()
         case 'M': // write memory
             this->HandleWriteMemory(*buffer);
             break;
+        case 'b': // reverse step/continue
+            this->HandleReverse(*buffer);
+            break;
+        case 'x': // read memory (binary)
+            this->HandleReadMemoryBinary(*buffer);
+            break;
         case 'q': // general get query
             this->HandleGeneralGetQuery(*buffer);
             break;
@@ -198,14 +305,112 @@ void GdbStub::ConnectionLoop()
     }
     
     if (interrupted) {
-        this->debugger->Halt(StopReason::BPReason);
+        // ^C stops every instance, as gdb expects in all-stop mode.
+        for (Debugger* target : Targets()) {
+            target->Halt(target->Trap("", 2)); // 2: SIGINT
+        }
+        HaltedTogether();
     }
     
-    if (this->waiting_for_stop && this->debugger->stop_reason != nullptr) {
-        this->Stop();
+    this->Stop();
+}
+
+// Stubs by address and port, so instances asking for the same endpoint
+// share it.
+static std::vector<GdbStub*> stubs;
+static pthread_mutex_t stubs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* GdbRun(void* ctx)
+{
+    GdbStub* stub = (GdbStub*)ctx;
+    stub->Run();
+    LOG(WARNING) << "GDB stub has exited the run method!";
+    return NULL;
+}
+
+GdbStub* GdbStub::Serve(Debugger* debugger, std::string address, int port)
+{
+    pthread_mutex_lock(&stubs_lock);
+    GdbStub* stub = nullptr;
+    for (GdbStub* existing : stubs) {
+        if (existing->address == address && existing->port == port) {
+            stub = existing;
+            break;
+        }
     }
+    bool created = stub == nullptr;
+    if (created) {
+        stub = new GdbStub(address, port);
+        stubs.push_back(stub);
+    }
+    stub->AddTarget(debugger);
+    pthread_mutex_unlock(&stubs_lock);
     
-    this->connection->ReadInput();
+    if (created) {
+        pthread_create(&stub->thread, NULL, GdbRun, stub);
+    }
+    return stub;
+}
+
+void GdbStub::AddTarget(Debugger* target)
+{
+    pthread_mutex_lock(&targets_lock);
+    targets.push_back(target);
+    target->SetThreadId(targets.size());
+    if (debugger == nullptr) {
+        debugger = target;
+    }
+    pthread_mutex_unlock(&targets_lock);
+}
+
+std::vector<Debugger*> GdbStub::Targets()
+{
+    pthread_mutex_lock(&targets_lock);
+    std::vector<Debugger*> copy = targets;
+    pthread_mutex_unlock(&targets_lock);
+    return copy;
+}
+
+Debugger* GdbStub::Target(int64_t thread_id)
+{
+    std::vector<Debugger*> copy = Targets();
+    if (thread_id <= 0) {
+        return debugger;
+    }
+    return (size_t) thread_id <= copy.size() ? copy[thread_id - 1] : nullptr;
+}
+
+void GdbStub::DrainWakeups()
+{
+    char discard[64];
+    while (read(wake_fds[0], discard, sizeof(discard)) > 0) {}
+}
+
+void GdbStub::WaitForHalt()
+{
+    // Halt sets is_halted before it signals, so no wakeup can be missed.
+    // The socket is watched as well, so ^C or a dropped connection ends
+    // the wait by halting the target.
+    while (!debugger->is_halted) {
+        struct pollfd fds[2] = {
+            { wake_fds[0], POLLIN, 0 },
+            { connection->sockfd, POLLIN, 0 }
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            LOG(ERROR) << "poll failed: " << errno;
+            return;
+        }
+        DrainWakeups();
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+            connection->ReadInput();
+            if (connection->ConsumeInterrupt() || !connection->connection_alive) {
+                debugger->Halt(debugger->Trap("", 2)); // 2: SIGINT
+            }
+        }
+    }
+    // The caller reports this stop itself.
+    reported[debugger] = debugger->stop_reason;
 }
 
 GdbStub::Query::Query(GdbStub &stub, std::string field, void (GdbStub::*visitor)(util::Buffer&), bool should_advertise, char separator) :
@@ -218,8 +423,11 @@ GdbStub::Query::Query(GdbStub &stub, std::string field, void (GdbStub::*visitor)
 
 void GdbStub::NotifyHalted(StopReason *reason)
 {
-    if (connection != nullptr) {
-        this->Stop();
+    // Called on the emulation thread; the stop reply itself is sent by
+    // the stub thread once poll wakes it up.
+    char wake = 1;
+    if (write(wake_fds[1], &wake, sizeof(wake)) < 0 && errno != EAGAIN) {
+        LOG(ERROR) << "error signalling halt: " << errno;
     }
 }
 
@@ -260,9 +468,48 @@ void GdbStub::AddXferObject(std::string name, XferObject &object) {
 }
 
 void GdbStub::Stop() {
-    if (waiting_for_stop) {
-        waiting_for_stop = false;
-        HandleGetStopReason(); // send reason
+    if (!waiting_for_stop) {
+        return;
+    }
+    Debugger* target = PendingStop();
+    if (target == nullptr) {
+        return;
+    }
+    waiting_for_stop = false;
+    debugger = target; // gdb switches to the thread that stopped
+    
+    StopReason* reason = target->stop_reason;
+    if (!reason->message.empty()) {
+        util::Buffer output;
+        output.Write('O');
+        GdbConnection::Encode(reason->message + "\n", output);
+        connection->Respond(output);
+    }
+    HandleGetStopReason(); // send reason
+}
+
+Debugger* GdbStub::PendingStop() {
+    // Prefer the current thread so a step is reported on it.
+    StopReason* reason = debugger->stop_reason;
+    if (reason != nullptr && reported[debugger] != reason) {
+        return debugger;
+    }
+    for (Debugger* target : Targets()) {
+        reason = target->stop_reason;
+        if (reason != nullptr && reported[target] != reason) {
+            return target;
+        }
+    }
+    return nullptr;
+}
+
+void GdbStub::HaltedTogether() {
+    // Only the current thread's stop gets reported; the others stopped
+    // because of it.
+    for (Debugger* target : Targets()) {
+        if (target != debugger) {
+            reported[target] = target->stop_reason;
+        }
     }
 }
 
@@ -337,6 +584,12 @@ void GdbStub::HandleGeneralSetQuery(util::Buffer &packet) {
 }
 
 void GdbStub::HandleIsThreadAlive(util::Buffer &packet) {
+	int64_t pid, thread_id;
+	ReadThreadId(packet, pid, thread_id);
+	if(Target(thread_id) == nullptr) {
+		connection->RespondError(1);
+		return;
+	}
 	connection->RespondOk();
 }
 
@@ -359,10 +612,15 @@ void GdbStub::HandleMultiletterPacket(util::Buffer &packet) {
 
 void GdbStub::HandleGetStopReason() {
 	util::Buffer buf;
-    if (debugger->stop_reason == nullptr) {
+    StopReason* reason = debugger->stop_reason;
+    reported[debugger] = reason;
+    if (reason == nullptr) {
         connection->RespondOk();
     } else {
-        debugger->stop_reason->Encode(buf);
+        reason->Encode(buf);
+        if (reason->type == StopReason::StopType::signal_extended) {
+            debugger->Execute([&] { debugger->EncodeStopRegisters(buf); });
+        }
         connection->Respond(buf);
     }
 }
@@ -375,7 +633,7 @@ void GdbStub::HandleDetach(util::Buffer &packet) {
 
 void GdbStub::HandleReadGeneralRegisters() {
     util::Buffer response;
-    debugger->EncodeRegisters(response);
+    debugger->Execute([&] { debugger->EncodeRegisters(response); });
     
     LOG(INFO) << "Responding with register contents: " << response.GetString();
     
@@ -403,6 +661,17 @@ void GdbStub::HandleSetCurrentThread(util::Buffer &packet) {
 	int64_t pid, thread_id;
 	ReadThreadId(packet, pid, thread_id);
 	
+	// Hg picks the instance for register, memory and breakpoint packets.
+	// Hc is covered by the thread ids in vCont.
+	if(op == 'g' && thread_id > 0) {
+		Debugger *target = Target(thread_id);
+		if(target == nullptr) {
+			connection->RespondError(1);
+			return;
+		}
+		debugger = target;
+	}
+	
 	connection->RespondOk();
 }
 
@@ -410,18 +679,48 @@ void GdbStub::HandleReadMemory(util::Buffer &packet) {
 	uint64_t address, size;
 	GdbConnection::DecodeWithSeparator(address, ',', packet);
 	GdbConnection::Decode(size, packet);
+	size = std::min<uint64_t>(size, GdbConnection::max_memory_read);
     
     util::Buffer response;
-    debugger->EncodeMemory(response, address, size);
+    debugger->Execute([&] { debugger->EncodeMemory(response, address, size); });
+    if (size != 0 && response.ReadAvailable() == 0) {
+        connection->RespondError(14); // EFAULT, e.g. not collected in this frame
+        return;
+    }
     connection->Respond(response);
 }
 
+void GdbStub::HandleReadMemoryBinary(util::Buffer &packet) {
+	uint64_t address, size;
+	GdbConnection::DecodeWithSeparator(address, ',', packet);
+	GdbConnection::Decode(size, packet);
+	size = std::min<uint64_t>(size, GdbConnection::max_memory_read);
+
+	std::vector<uint8_t> data(size);
+	size_t read = 0;
+	debugger->Execute([&] { read = debugger->PeekMemory(address, size, data.data()); });
+	if (size != 0 && read == 0) {
+		connection->RespondError(14); // EFAULT
+		return;
+	}
+
+	util::Buffer response;
+	response.Write('b');
+	response.Write(data.data(), read);
+	connection->Respond(response);
+}
+
 void GdbStub::HandleWriteMemory(util::Buffer &packet) {
 	uint64_t address, size;
 	GdbConnection::DecodeWithSeparator(address, ',', packet);
 	GdbConnection::DecodeWithSeparator(size, ':', packet);
     
-    debugger->WriteMemory(address, size, packet);
+    bool written = false;
+    debugger->Execute([&] { written = debugger->WriteMemory(address, size, packet); });
+    if (!written) {
+        connection->RespondError(14); // EFAULT
+        return;
+    }
     connection->RespondOk();
 }
 
@@ -434,15 +733,77 @@ void GdbStub::HandleBreakpoint(util::Buffer &packet, bool remove)
     
     LOG(DEBUG) << "Handle Breakpoint type: " << type << ", address: " << address << ", kind: " << kind;
     
-    if (remove) {
-        debugger->RemoveBreakpoints(address);
-    } else {
-        debugger->AddBreakpoint(new Breakpoint(address, -1));
+    switch (type) {
+        case 0: // software breakpoint
+        case 1: { // hardware breakpoint
+            // gdb resends the breakpoint when its conditions change, so
+            // always replace whatever is at this address.
+            Breakpoint* bp = nullptr;
+            if (!remove) {
+                bp = new Breakpoint(address, -1);
+                ReadConditionList(packet, bp->conditions);
+            }
+            debugger->Execute([&] {
+                debugger->RemoveBreakpoints(address);
+                if (bp != nullptr) debugger->AddBreakpoint(bp);
+            });
+            break;
+        }
+        case 2: // write watchpoint
+        case 3: // read watchpoint
+        case 4: { // access watchpoint
+            // For watchpoints, kind is the length of the watched range.
+            Watchpoint::Type wtype = type == 2 ? Watchpoint::Type::write
+                                   : type == 3 ? Watchpoint::Type::read
+                                   : Watchpoint::Type::access;
+            // A banked address must stay inside its bank's 0x4000-0x7fff window.
+            long offset = address & 0xffff;
+            if (address > 0xffff && (offset < 0x4000 || offset + kind > 0x8000)) {
+                connection->RespondError(22); // EINVAL
+                return;
+            }
+            debugger->Execute([&] {
+                if (remove) {
+                    debugger->RemoveWatchpoint(address, kind, wtype);
+                } else {
+                    debugger->AddWatchpoint(new Watchpoint(address, kind, wtype));
+                }
+            });
+            break;
+        }
+        default:
+            connection->RespondEmpty();
+            return;
     }
     
     connection->RespondOk();
 }
 
+void GdbStub::ReadConditionList(util::Buffer &packet, std::vector<AgentExpression> &conditions)
+{
+    // cond_list is a run of "X len,expr" entries, optionally followed by
+    // ";cmds:..." which we don't support.
+    while (packet.ReadAvailable() && packet.Read()[0] == 'X') {
+        packet.MarkRead(1); // consume
+        uint64_t length;
+        GdbConnection::DecodeWithSeparator(length, ',', packet);
+        if (packet.ReadAvailable() < length * 2) {
+            LOG(WARNING) << "truncated breakpoint condition";
+            return;
+        }
+        std::vector<uint8_t> bytecode;
+        bytecode.reserve(length);
+        for (uint64_t i = 0; i < length; i++) {
+            bytecode.push_back(GdbConnection::DecodeHexByte((char*) packet.Read()));
+            packet.MarkRead(2); // consume
+        }
+        conditions.emplace_back(bytecode);
+        if (packet.ReadAvailable() && packet.Read()[0] == ';') {
+            packet.MarkRead(1); // consume
+        }
+    }
+}
+
 #pragma mark V Handlers
 
 void GdbStub::HandleVAttach(util::Buffer &packet) {
@@ -460,9 +821,27 @@ void GdbStub::HandleVAttach(util::Buffer &packet) {
 	HandleGetStopReason();
 }
 
+void GdbStub::HandleReverse(util::Buffer &packet) {
+	char ch;
+	if(!packet.Read(ch) || (ch != 's' && ch != 'c')) {
+		connection->RespondEmpty();
+		return;
+	}
+	
+	// The stop reply is sent once the replay reaches its target.
+	debugger->Execute([&] {
+		if(ch == 's') {
+			debugger->ReverseStep();
+		} else {
+			debugger->ReverseContinue();
+		}
+	});
+	waiting_for_stop = true;
+}
+
 void GdbStub::HandleVContQuery(util::Buffer &packet) {
 	util::Buffer response;
-	response.Write(std::string("vCont;c;C"));
+	response.Write("vCont;c;C;s;r");
 	connection->Respond(response);
 }
 
@@ -477,15 +856,16 @@ void GdbStub::HandleVCont(util::Buffer &packet) {
 		enum class Type {
 			Invalid,
 			Continue,
-            Step
+            Step,
+            Range
 		} type = Type::Invalid;
         int64_t pid = -1;
         int64_t thread_id = -1;
+        uint64_t start = 0;
+        uint64_t end = 0;
 	};
 
-	std::map<uint64_t, std::map<uint64_t, Action>> process_actions;
-    
-    bool unhalt = false;
+	std::vector<Action> actions;
 	
 	while(read_success) {
 		read_success = packet.Read(ch);
@@ -506,6 +886,11 @@ void GdbStub::HandleVCont(util::Buffer &packet) {
 				break;
             case 's':
                 action.type = Action::Type::Step;
+                break;
+            case 'r':
+                action.type = Action::Type::Range;
+                GdbConnection::DecodeWithSeparator(action.start, ',', action_buffer);
+                GdbConnection::Decode(action.end, action_buffer);
                 break;
 			default:
 				LOG(WARNING) << "unsupported vCont action: " << ch;
@@ -516,17 +901,8 @@ void GdbStub::HandleVCont(util::Buffer &packet) {
 					ReadThreadId(thread_id_buffer, action.pid, action.thread_id);
 				}
 				LOG(DEBUG) << "vCont " << action.pid << ", " << action.thread_id << ", action " << ch;
+				actions.push_back(action);
 			}
-            
-            switch (action.type) {
-                case Action::Type::Step:
-                    debugger->step_range = std::make_tuple(debugger->cpu->correct_pc, debugger->cpu->correct_pc);
-                    break;
-                default:
-                    break;
-            }
-            
-            unhalt = true;
 			
 			reading_action = true;
 			action_buffer.Clear();
@@ -544,8 +920,43 @@ void GdbStub::HandleVCont(util::Buffer &packet) {
 		}
 	}
     
-    if (unhalt) debugger->Unhalt();
     waiting_for_stop = true;
+    
+    // As in gdbserver, a stop gdb has not seen yet is reported before
+    // anything is resumed.
+    if (PendingStop() != nullptr) {
+        Stop();
+        return;
+    }
+    
+    // Each instance takes the first action naming it (or naming no thread).
+    // Instances without an action are left as they are.
+    std::vector<Debugger*> targets = Targets();
+    for (size_t i = 0; i < targets.size(); i++) {
+        Debugger* target = targets[i];
+        for (Action &action : actions) {
+            if (action.thread_id > 0 && action.thread_id != (int64_t) i + 1) continue;
+            if (action.thread_id == 0 && target != debugger) continue;
+            target->Execute([&] {
+                switch (action.type) {
+                    case Action::Type::Step: {
+                        long pc = target->BankedAddress(target->cpu->correct_pc);
+                        target->SetStepRange(pc, pc);
+                        break;
+                    }
+                    case Action::Type::Range:
+                        // Keep stepping while the pc stays in [start, end); the
+                        // whole range runs without a round trip to gdb.
+                        target->SetStepRange(action.start, (long) action.end - 1);
+                        break;
+                    default:
+                        break;
+                }
+                target->Unhalt();
+            });
+            break;
+        }
+    }
 	LOG(DEBUG) << "reached end of vCont";
 }
 
@@ -591,47 +1002,57 @@ void GdbStub::QueryGetSupported(util::Buffer &packet) {
 	connection->Respond(response);
 }
 
-void GdbStub::QueryGetCurrentThread(util::Buffer &packet) {
-	util::Buffer response;
+void GdbStub::WriteThreadId(int64_t thread_id, util::Buffer &response) {
 	if(multiprocess_enabled) {
 		response.Write('p');
 		GdbConnection::Encode((uint64_t)1, 0, response);
 		response.Write('.');
 	}
-	GdbConnection::Encode((uint64_t)1, 0, response);
+	GdbConnection::Encode((uint64_t)thread_id, 0, response);
+}
+
+void GdbStub::QueryGetCurrentThread(util::Buffer &packet) {
+	util::Buffer response;
+	response.Write('Q');
+	response.Write('C');
+	WriteThreadId(debugger->ThreadId(), response);
 	connection->Respond(response);
 }
 
 void GdbStub::QueryGetFThreadInfo(util::Buffer &packet) {
-    sent_thread_info = false;
-    QueryGetSThreadInfo(packet);
+	// Every instance fits in the first reply; qsThreadInfo ends the list.
+	util::Buffer response;
+	response.Write('m');
+	std::vector<Debugger*> targets = Targets();
+	for(size_t i = 0; i < targets.size(); i++) {
+		if(i > 0) {
+			response.Write(',');
+		}
+		WriteThreadId(targets[i]->ThreadId(), response);
+	}
+	connection->Respond(response);
 }
 
 void GdbStub::QueryGetSThreadInfo(util::Buffer &packet) {
 	util::Buffer response;
-    if (sent_thread_info == false) {
-        response.Write('m');
-       if(multiprocess_enabled) {
-           response.Write('p');
-           GdbConnection::Encode((uint64_t)1, 0, response);
-           response.Write('.');
-       }
-       GdbConnection::Encode(1, 0, response);
-       response.Write('l'); // End of list
-        sent_thread_info = true;
-    }
-   
+	response.Write('l'); // End of list
 	connection->Respond(response);
 }
 
 void GdbStub::QueryGetThreadExtraInfo(util::Buffer &packet) {
 	int64_t pid, thread_id;
 	ReadThreadId(packet, pid, thread_id);
-
-    // TODO: Handle this!
 	
+	Debugger *target = Target(thread_id);
+	if(target == nullptr) {
+		connection->RespondError(1);
+		return;
+	}
+	
+	std::stringstream extra_info;
+	extra_info << "Game Boy " << thread_id << (target->is_halted ? ", halted" : ", running");
 	util::Buffer response;
-	//GdbConnection::Encode(extra_info, response);
+	GdbConnection::Encode(extra_info.str(), response);
 	connection->Respond(response);
 }
 
@@ -644,6 +1065,26 @@ void GdbStub::QueryGetOffsets(util::Buffer &packet) {
 	connection->Respond(response);
 }
 
+// Parses a whole monitor command argument as an unsigned number no larger
+// than max. Signs, trailing junk and overflow all count as invalid arguments,
+// so a bad number never escapes the handler as std::out_of_range.
+static unsigned long ParseArgument(const std::string &text, int base, unsigned long max) {
+	size_t first = text.find_first_not_of(' ');
+	if(first == std::string::npos || !isxdigit((unsigned char) text[first])) {
+		throw std::invalid_argument(text);
+	}
+	char *end;
+	errno = 0;
+	unsigned long value = strtoul(text.c_str() + first, &end, base);
+	while(*end == ' ') {
+		end++;
+	}
+	if(*end != '\0' || errno == ERANGE || value > max) {
+		throw std::invalid_argument(text);
+	}
+	return value;
+}
+
 void GdbStub::QueryGetRemoteCommand(util::Buffer &packet) {
 	util::Buffer message;
 	GdbConnection::Decode(message, packet);
@@ -658,6 +1099,231 @@ void GdbStub::QueryGetRemoteCommand(util::Buffer &packet) {
 	try {
 		if(command == "help") {
 			response << "Available commands:" << std::endl;
+			response << "  breakpoints - list breakpoints with their hit counts" << std::endl;
+			response << "  history - show the reverse execution snapshots" << std::endl;
+			response << "  trace start <file> [delta] - write an instruction trace to file" << std::endl;
+			response << "  trace stop - finish the trace" << std::endl;
+			response << "  trace - show the trace status" << std::endl;
+			response << "  runcycles <n> - resume for n cpu cycles, then stop" << std::endl;
+			response << "  runframes <n> - resume until n frames have completed, then stop" << std::endl;
+			response << "  catch [interrupt [vblank|stat|timer|serial|joypad] | halt | stop | bank | io <ff00-ffff>]" << std::endl;
+			response << "        - stop on the event; without arguments, list the catchpoints" << std::endl;
+			response << "  catch clear [<event> [<argument>]] - remove catchpoints" << std::endl;
+			response << "  scan start - snapshot WRAM, cartridge RAM and HRAM; every byte is a candidate" << std::endl;
+			response << "  scan changed|unchanged|increased|decreased - keep candidates compared to the last snapshot" << std::endl;
+			response << "  scan eq|ne <value> - keep candidates equal or not equal to value" << std::endl;
+			response << "  scan list [n] - show up to n (default 20) candidates" << std::endl;
+			response << "  profile [clear] - show or reset the profiling counters (GAMBATTE_PROFILE builds)" << std::endl;
+		} else if(command == "breakpoints") {
+			debugger->Execute([&] {
+				for(auto &entry : debugger->breakpoints) {
+					for(Breakpoint *bp : entry.second) {
+						response << std::hex << "0x" << bp->address << std::dec
+						         << ": hits " << bp->hits
+						         << ", conditions " << bp->conditions.size()
+						         << (bp->enabled ? "" : " (disabled)") << std::endl;
+					}
+				}
+			});
+		} else if(command == "history") {
+			debugger->Execute([&] {
+				History &history = debugger->history;
+				response << history.Count() << "/" << history.Slots() << " snapshots";
+				if(history.Count()) {
+					response << ", instructions " << history.Oldest() << " to " << history.Newest();
+				}
+				response << ", now at " << debugger->position << std::endl;
+			});
+		} else if(command == "trace") {
+			std::string action, path, encoding;
+			std::istringstream args(message.GetString());
+			args >> action >> path >> encoding;
+			if(action == "start" && !path.empty()) {
+				bool started = false;
+				debugger->Execute([&] { started = debugger->StartTrace(path, encoding == "delta"); });
+				response << (started ? "Tracing to " : "Could not open ") << path << std::endl;
+			} else if(action == "stop") {
+				debugger->Execute([&] {
+					if(debugger->tracer) {
+						Tracer &tracer = *debugger->tracer;
+						tracer.Stop();
+						response << "Stopped tracing to " << tracer.Path() << ", "
+						         << tracer.Written() << " records" << std::endl;
+						debugger->StopTrace();
+					} else {
+						response << "Not tracing" << std::endl;
+					}
+				});
+			} else if(action.empty()) {
+				debugger->Execute([&] {
+					if(debugger->tracer) {
+						response << "Tracing to " << debugger->tracer->Path() << ", "
+						         << debugger->tracer->Written() << " records written, "
+						         << debugger->tracer->Stalls() << " stalls" << std::endl;
+					} else {
+						response << "Not tracing" << std::endl;
+					}
+				});
+			} else {
+				response << "Usage: trace [start <file> [delta] | stop]" << std::endl;
+			}
+		} else if(command == "catch") {
+			std::string event, argument;
+			std::istringstream args(message.GetString());
+			args >> event;
+			bool enable = event != "clear";
+			if(!enable) {
+				event.clear();
+				args >> event;
+			}
+			args >> argument;
+			
+			long value = -1;
+			static const char* interrupts[] = { "vblank", "stat", "timer", "serial", "joypad" };
+			if(event == "interrupt" && !argument.empty()) {
+				value = 0;
+				for(int i = 0; i < 5; i++) {
+					if(argument == interrupts[i]) value = 1 << i;
+				}
+				if(value == 0) throw std::invalid_argument(argument);
+			} else if(event == "io" && !argument.empty()) {
+				value = ParseArgument(argument, 16, 0xffff);
+				if(value > 0xff && value < 0xff00) throw std::invalid_argument(argument);
+				// HRAM (FF80-FFFE) writes take the fast path and never reach the catch.
+				if(static_cast<unsigned>(value & 0xff) - 0x80u < 0x7fu) throw std::invalid_argument(argument);
+			}
+			
+			debugger->Execute([&] {
+				if(event.empty() && enable) {
+					std::string armed = debugger->DescribeCatchpoints();
+					response << (armed.empty() ? "No catchpoints\n" : "Catchpoints:\n" + armed);
+				} else if(event.empty()) {
+					for(const char* all : { "interrupt", "halt", "stop", "bank", "io" }) {
+						debugger->SetCatchpoint(all, -1, false);
+					}
+					response << "Cleared all catchpoints" << std::endl;
+				} else if(debugger->SetCatchpoint(event, value, enable)) {
+					response << (enable ? "Catching " : "No longer catching ") << event
+					         << (argument.empty() ? "" : " ") << argument << std::endl;
+				} else {
+					response << "Usage: catch [clear] [interrupt [vblank|stat|timer|serial|joypad] | halt | stop | bank | io <register>]" << std::endl;
+				}
+			});
+		} else if(command == "scan") {
+			std::string action;
+			std::istringstream args(message.GetString());
+			args >> action;
+			
+			static const std::unordered_map<std::string, MemoryScan::Filter> filters = {
+				{ "changed", MemoryScan::Filter::changed },
+				{ "unchanged", MemoryScan::Filter::unchanged },
+				{ "increased", MemoryScan::Filter::increased },
+				{ "decreased", MemoryScan::Filter::decreased },
+				{ "eq", MemoryScan::Filter::equal },
+				{ "ne", MemoryScan::Filter::not_equal }
+			};
+			auto filter = filters.find(action);
+			unsigned long value = 0;
+			if(action == "eq" || action == "ne") {
+				std::string argument;
+				args >> argument;
+				value = ParseArgument(argument, 0, 0xff);
+			}
+			
+			debugger->Execute([&] {
+				MemoryScan &scan = debugger->scan;
+				auto start = std::chrono::steady_clock::now();
+				if(action == "start") {
+					scan.Start(debugger->ScanRegions());
+				} else if(filter != filters.end()) {
+					if(!scan.Narrow(debugger->ScanRegions(), filter->second, value)) {
+						response << "No scan in progress, or the memory layout changed; use scan start" << std::endl;
+						return;
+					}
+				} else if(action == "list") {
+					size_t limit = 20;
+					args >> limit;
+					scan.List(response, limit);
+					return;
+				} else if(!action.empty()) {
+					response << "Usage: scan [start | changed | unchanged | increased | decreased | eq <v> | ne <v> | list [n]]" << std::endl;
+					return;
+				}
+				auto took = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+				if(!scan.Started()) {
+					response << "No scan in progress" << std::endl;
+				} else {
+					response << scan.Count() << " candidates";
+					if(!action.empty()) {
+						response << " (" << took.count() << " us)";
+					}
+					response << std::endl;
+				}
+			});
+		} else if(command == "profile") {
+#ifdef GAMBATTE_PROFILE
+			std::string action;
+			std::istringstream args(message.GetString());
+			args >> action;
+			debugger->Execute([&] {
+				Profile &profile = debugger->cpu->mem_.profile();
+				if(action == "clear") {
+					profile = Profile();
+					response << "Cleared the profiling counters" << std::endl;
+					return;
+				}
+				
+				// Prints the `count` busiest entries of `counters`, with their
+				// share of `counters` in total.
+				auto top = [&](const char* title, const char* prefix, const char* suffix, const unsigned long long* counters, size_t size, size_t count) {
+					std::vector<size_t> order(size);
+					unsigned long long total = 0;
+					for(size_t i = 0; i < size; i++) {
+						order[i] = i;
+						total += counters[i];
+					}
+					std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return counters[a] > counters[b]; });
+					response << title << ": " << std::dec << total << std::endl;
+					for(size_t i = 0; i < count && i < size && counters[order[i]]; i++) {
+						response << "  " << prefix << std::hex << std::setw(2) << std::setfill('0') << order[i] << suffix
+						         << std::dec << std::setfill(' ') << std::setw(14) << counters[order[i]]
+						         << std::fixed << std::setprecision(1) << std::setw(7)
+						         << 100.0 * counters[order[i]] / total << "%" << std::endl;
+					}
+				};
+				
+				response << std::fixed << std::setprecision(3)
+				         << "Host time: cpu loop " << profile.cpuNs / 1e6 << " ms, of which lcd "
+				         << profile.lcdNs / 1e6 << " ms and psg " << profile.psgNs / 1e6 << " ms" << std::endl;
+				top("Opcodes", "", "", profile.opcodes, 0x100, 16);
+				top("CB opcodes", "cb ", "", profile.cbOpcodes, 0x100, 8);
+				
+				static const char* events[] = { "unhalt", "end", "blit", "serial", "oam", "dma", "tima", "video", "interrupts" };
+				response << "Events:" << std::endl;
+				for(size_t i = 0; i < 9; i++) {
+					response << "  " << std::left << std::setw(11) << events[i] << std::right
+					         << std::setw(14) << profile.events[i] << std::endl;
+				}
+				top("I/O reads", "ff", "", profile.ioReads, 0x100, 8);
+				top("I/O writes", "ff", "", profile.ioWrites, 0x100, 8);
+				top("Slow path reads by page", "", "xx", profile.pageReads, 0x100, 8);
+				top("Slow path writes by page", "", "xx", profile.pageWrites, 0x100, 8);
+			});
+#else
+			response << "Profiling is not compiled in; build with GAMBATTE_PROFILE" << std::endl;
+#endif
+		} else if(command == "runcycles" || command == "runframes") {
+			// Synchronous: the reply is sent once the cpu halts again, so gdb
+			// still sees a stopped target (use flushregs to refetch registers).
+			unsigned long budget = ParseArgument(message.GetString(), 0, ULONG_MAX);
+			bool frames = command == "runframes";
+			bool spent = false;
+			unsigned long elapsed = 0;
+			debugger->Execute([&] { debugger->RunBudget(frames ? 0 : budget, frames ? budget : 0); });
+			WaitForHalt();
+			debugger->Execute([&] { spent = debugger->EndBudget(elapsed); });
+			response << (spent ? "Stopped" : "Interrupted") << " after " << elapsed << " cycles at pc 0x"
+			         << std::hex << debugger->cpu->correct_pc << std::endl;
 		} else {
 			response << "Unknown command '" << command << "'" << std::endl;
 		}
@@ -670,6 +1336,40 @@ void GdbStub::QueryGetRemoteCommand(util::Buffer &packet) {
 	connection->Respond(response_buffer);
 }
 
+void GdbStub::QueryGetSearch(util::Buffer &packet) {
+	std::string space;
+	char ch;
+	while(packet.Read(ch) && ch != ':') {
+		space.push_back(ch);
+	}
+	if(space != "memory") {
+		connection->RespondEmpty();
+		return;
+	}
+	
+	uint64_t address, length;
+	GdbConnection::DecodeWithSeparator(address, ';', packet);
+	GdbConnection::DecodeWithSeparator(length, ';', packet);
+	// The pattern is binary; the connection has already unescaped it.
+	std::vector<uint8_t> pattern;
+	while(packet.Read(ch)) {
+		pattern.push_back(ch);
+	}
+	
+	bool found = false;
+	long match = 0;
+	debugger->Execute([&] { found = debugger->SearchMemory(address, length, pattern, match); });
+	
+	util::Buffer response;
+	if(found) {
+		response.Write("1,");
+		GdbConnection::Encode((uint64_t)match, 0, response);
+	} else {
+		response.Write('0');
+	}
+	connection->Respond(response);
+}
+
 void GdbStub::QueryXfer(util::Buffer &packet) {
 	std::string object_name;
 	std::string op;
@@ -715,8 +1415,272 @@ void GdbStub::QueryXfer(util::Buffer &packet) {
 }
 
 void GdbStub::QueryGetTStatus(util::Buffer &packet) {
+    std::stringstream status;
+    debugger->Execute([&] {
+        size_t frames = 0, used = 0, size = 0;
+        if (debugger->trace_buffer) {
+            frames = debugger->trace_buffer->Frames();
+            used = debugger->trace_buffer->Used();
+            size = debugger->trace_buffer->Size();
+        }
+        status << std::hex;
+        if (debugger->tracing) {
+            status << "T1";
+        } else {
+            status << "T0;" << debugger->trace_stop_reason;
+        }
+        status << ";tframes:" << frames << ";tcreated:" << frames
+               << ";tsize:" << size << ";tfree:" << size - used
+               << ";circular:0;disconn:0";
+    });
+    std::string text = status.str();
+    util::Buffer response;
+    response.Write(text);
+    connection->Respond(response);
+}
+
+void GdbStub::QueryGetTracepointStatus(util::Buffer &packet) {
+    // qTP:n:addr -> V<hits>:<bytes>
+    uint64_t number, address;
+    GdbConnection::DecodeWithSeparator(number, ':', packet);
+    GdbConnection::Decode(address, packet);
+    
+    std::stringstream status;
+    debugger->Execute([&] {
+        Tracepoint* tp = debugger->FindTracepoint(number, address);
+        if (tp != nullptr) {
+            status << std::hex << "V" << tp->hits << ":0";
+        }
+    });
+    std::string text = status.str();
+    util::Buffer response;
+    response.Write(text);
+    connection->Respond(response);
+}
+
+void GdbStub::QueryGetEmptyList(util::Buffer &packet) {
     util::Buffer response;
-    response.Write("T0");
+    response.Write("l");
+    connection->Respond(response);
+}
+
+void GdbStub::QuerySetIgnored(util::Buffer &packet) {
+    connection->RespondOk();
+}
+
+void GdbStub::QuerySetTraceInit(util::Buffer &packet) {
+    debugger->Execute([&] { debugger->ClearTracepoints(); });
+    connection->RespondOk();
+}
+
+/// Reads a hex number from `s` at `pos`, advancing past it. Returns false
+/// if there is none.
+static bool ReadHex(const std::string &s, size_t &pos, uint64_t &out) {
+    size_t start = pos;
+    out = 0;
+    while (pos < s.size() && isxdigit((unsigned char) s[pos])) {
+        out = out << 4 | GdbConnection::DecodeHexNybble(s[pos]);
+        pos++;
+    }
+    return pos != start;
+}
+
+static bool ReadBytecode(const std::string &s, size_t &pos, std::vector<uint8_t> &bytecode) {
+    uint64_t length;
+    if (!ReadHex(s, pos, length) || pos >= s.size() || s[pos] != ',' || s.size() - pos - 1 < length * 2) {
+        return false;
+    }
+    pos++;
+    for (uint64_t i = 0; i < length; i++, pos += 2) {
+        bytecode.push_back(GdbConnection::DecodeHexByte((char*) s.c_str() + pos));
+    }
+    return true;
+}
+
+void GdbStub::QuerySetTracepoint(util::Buffer &packet) {
+    // QTDP:n:addr:E|D:step:pass[:Fflen][:Xlen,cond][-]
+    // QTDP:-n:addr:action...[-]
+    std::string definition = packet.GetString();
+    size_t pos = 0;
+    bool actions = !definition.empty() && definition[0] == '-';
+    if (actions) {
+        pos++;
+    }
+    
+    uint64_t number, address;
+    if (!ReadHex(definition, pos, number) || definition[pos++] != ':' ||
+        !ReadHex(definition, pos, address) || pos >= definition.size() || definition[pos++] != ':') {
+        connection->RespondError(1);
+        return;
+    }
+    
+    bool ok = true;
+    if (!actions) {
+        Tracepoint* tp = new Tracepoint(number, address);
+        uint64_t step, pass;
+        tp->enabled = pos < definition.size() && definition[pos++] == 'E';
+        ok = pos < definition.size() && definition[pos++] == ':' &&
+             ReadHex(definition, pos, step) && pos < definition.size() && definition[pos++] == ':' &&
+             ReadHex(definition, pos, pass);
+        if (ok) {
+            tp->pass_count = pass;
+        }
+        while (ok && pos < definition.size() && definition[pos] == ':') {
+            pos++;
+            if (definition[pos] == 'F') {
+                // Fast tracepoints are the same as normal ones here.
+                uint64_t length;
+                pos++;
+                ok = ReadHex(definition, pos, length);
+            } else if (definition[pos] == 'X') {
+                std::vector<uint8_t> bytecode;
+                pos++;
+                ok = ReadBytecode(definition, pos, bytecode);
+                if (ok) {
+                    tp->conditions.emplace_back(bytecode);
+                }
+            } else {
+                ok = false;
+            }
+        }
+        if (!ok) {
+            delete tp;
+        } else {
+            debugger->Execute([&] { debugger->AddTracepoint(tp); });
+        }
+    } else {
+        // Parse the whole packet first so a bad one leaves the tracepoint as it was.
+        uint32_t registers = 0;
+        std::vector<Tracepoint::MemoryRange> memory;
+        std::vector<AgentExpression> expressions;
+        while (ok && pos < definition.size() && definition[pos] != '-') {
+            char action = definition[pos++];
+            if (action == 'R') {
+                uint64_t mask;
+                ok = ReadHex(definition, pos, mask);
+                if (ok) {
+                    registers |= mask;
+                }
+            } else if (action == 'M') {
+                // M basereg,offset,len; basereg -1 means absolute.
+                uint64_t base, offset, length;
+                bool absolute = pos < definition.size() && definition[pos] == '-';
+                if (absolute) {
+                    pos++;
+                }
+                ok = ReadHex(definition, pos, base) && definition[pos++] == ',' &&
+                     ReadHex(definition, pos, offset) && definition[pos++] == ',' &&
+                     ReadHex(definition, pos, length);
+                if (!ok) {
+                    break;
+                }
+                if (absolute || base >= Debugger::Registers.size()) {
+                    memory.push_back({-1, (long) offset, length});
+                } else {
+                    memory.push_back({(long) base, (long) offset, length});
+                }
+            } else if (action == 'X') {
+                std::vector<uint8_t> bytecode;
+                ok = ReadBytecode(definition, pos, bytecode);
+                if (ok) {
+                    expressions.emplace_back(bytecode);
+                }
+            } else if (action == 'S') {
+                // while-stepping actions are not supported; skip them.
+                pos = definition.size();
+            } else {
+                ok = false;
+            }
+        }
+        if (ok) {
+            debugger->Execute([&] {
+                Tracepoint* tp = debugger->FindTracepoint(number, address);
+                if (tp == nullptr) {
+                    ok = false;
+                    return;
+                }
+                tp->registers |= registers;
+                tp->memory.insert(tp->memory.end(), memory.begin(), memory.end());
+                tp->expressions.insert(tp->expressions.end(), expressions.begin(), expressions.end());
+            });
+        }
+    }
+    
+    if (!ok) {
+        LOG(WARNING) << "invalid tracepoint definition: " << definition;
+        connection->RespondError(1);
+        return;
+    }
+    connection->RespondOk();
+}
+
+void GdbStub::QuerySetTraceStart(util::Buffer &packet) {
+    debugger->Execute([&] { debugger->StartTracing(); });
+    connection->RespondOk();
+}
+
+void GdbStub::QuerySetTraceStop(util::Buffer &packet) {
+    debugger->Execute([&] { debugger->StopTracing("tstop:0"); });
+    connection->RespondOk();
+}
+
+void GdbStub::QuerySetTraceFrame(util::Buffer &packet) {
+    // QTFrame:n, pc:addr, tdp:t, range:start:end or outside:start:end.
+    // The searches look at the frames after the current one.
+    std::string request = packet.GetString();
+    std::string kind;
+    size_t pos = request.find(':');
+    if (pos != std::string::npos) {
+        kind = request.substr(0, pos);
+        pos++;
+    } else {
+        pos = 0;
+    }
+    uint64_t first = 0, second = 0;
+    ReadHex(request, pos, first);
+    if (pos < request.size() && request[pos] == ':') {
+        pos++;
+        ReadHex(request, pos, second);
+    }
+    
+    long found = -1;
+    long tracepoint = 0;
+    debugger->Execute([&] {
+        TraceBuffer* buffer = debugger->trace_buffer.get();
+        long frames = buffer ? buffer->Frames() : 0;
+        if (kind.empty()) {
+            bool stop_looking = (!request.empty() && request[0] == '-') || first == 0xffffffff;
+            found = (stop_looking || (long) first >= frames) ? -1 : first;
+        } else {
+            for (long frame = debugger->trace_frame + 1; frame < frames; frame++) {
+                uint32_t pc = 0;
+                buffer->FrameRegister(frame, Debugger::PcRegister, pc);
+                bool match = kind == "pc" ? pc == first
+                           : kind == "tdp" ? buffer->FrameTracepoint(frame) == (long) first
+                           : kind == "range" ? pc >= first && pc <= second
+                           : kind == "outside" ? pc < first || pc > second
+                           : false;
+                if (match) {
+                    found = frame;
+                    break;
+                }
+            }
+        }
+        debugger->trace_frame = found;
+        if (found >= 0) {
+            tracepoint = buffer->FrameTracepoint(found);
+        }
+    });
+    
+    std::stringstream response_text;
+    if (found < 0) {
+        response_text << "F-1";
+    } else {
+        response_text << std::hex << "F" << found << "T" << tracepoint;
+    }
+    std::string text = response_text.str();
+    util::Buffer response;
+    response.Write(text);
     connection->Respond(response);
 }
 
@@ -786,6 +1750,24 @@ std::string GdbStub::XferReadLibraries() {
     return "<library-list></library-list>";
 }
 
+std::string GdbStub::XferReadMemoryMap() {
+    unsigned banks = 0;
+    debugger->Execute([&] { banks = debugger->cpu->mem_.rombanks(); });
+    
+    // The 64K bus as the cpu sees it, followed by every ROM bank at
+    // bank * 0x10000 + 0x4000 so breakpoints can name a specific bank.
+    std::stringstream map;
+    map << "<?xml version=\"1.0\"?><!DOCTYPE memory-map PUBLIC \"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\" \"http://sourceware.org/gdb/gdb-memory-map.dtd\">";
+    map << "<memory-map>";
+    map << "<memory type=\"rom\" start=\"0x0\" length=\"0x8000\"/>";
+    map << "<memory type=\"ram\" start=\"0x8000\" length=\"0x8000\"/>";
+    for (unsigned bank = 1; bank < banks; bank++) {
+        map << std::hex << "<memory type=\"rom\" start=\"0x" << (bank << 16 | 0x4000) << "\" length=\"0x4000\"/>";
+    }
+    map << "</memory-map>";
+    return map.str();
+}
+
 GdbStub::FeaturesXferObject::FeaturesXferObject(GdbStub &stub) : stub(stub) {}
 
 void GdbStub::FeaturesXferObject::Read(std::string annex, size_t offset, size_t length)
@@ -22,6 +22,8 @@
 
 #include <unordered_map>
 #include <list>
+#include <vector>
+#include <pthread.h>
 #include "easylogging++.h"
 #include "GdbConnection.h"
 #include "Debugger.h"
@@ -29,16 +31,28 @@
 namespace gambatte {
 namespace debugger {
 
+/// One gdb endpoint. Every Debugger served by it is shown to gdb as a
+/// thread of process 1, with thread ids in the order they were added.
 class GdbStub {
  public:
-	GdbStub(Debugger* debugger, std::string address = "0.0.0.0", int port = 55555);
+	GdbStub(std::string address = "0.0.0.0", int port = 55555);
 	~GdbStub();
 	
+    /// Adds `debugger` to the stub listening on `address`:`port`, creating
+    /// the stub and its thread if there is none yet.
+    static GdbStub* Serve(Debugger* debugger, std::string address, int port);
+    void AddTarget(Debugger* target);
+	
     /// This method is responsible for opening and closing connections to remote clients.
+    /// It blocks in poll() on the sockets and the wake pipe, so it uses no CPU while idle.
 	void Run();
     void AcceptConnection(int sockfd);
+    /// Handles every complete packet currently buffered on the connection.
     void ConnectionLoop();
+    /// Wakes the stub thread so it can send the stop reply. Safe to call from any thread.
     void NotifyHalted(StopReason* reason);
+    /// Read by the emulation thread, hence the separate atomic flag.
+    bool HasConnection() const { return connected.load(std::memory_order_relaxed); }
 	
 	class Query {
 	 public:
@@ -91,12 +105,36 @@ class GdbStub {
 	bool has_async_wait = false;
 	bool multiprocess_enabled = false;
     
-    Debugger* debugger;
+    /// The thread selected with Hg, or the last one to stop.
+    Debugger* debugger = nullptr;
 
+    /// Sends the stop reply for a stop gdb has not seen, if it is waiting.
 	void Stop();
 	
  private:
 	GdbConnection* connection = nullptr;
+    std::atomic<bool> connected{false};
+    pthread_t thread;
+    
+    /// Served instances. Appended to from any thread, hence the lock.
+    std::vector<Debugger*> targets;
+    pthread_mutex_t targets_lock = PTHREAD_MUTEX_INITIALIZER;
+    std::vector<Debugger*> Targets();
+    /// Thread id to instance; 0 and -1 mean the current one.
+    Debugger* Target(int64_t thread_id);
+    
+    /// The stop last reported to gdb for each instance. An instance whose
+    /// stop_reason differs has a stop gdb has not seen.
+    std::unordered_map<Debugger*, StopReason*> reported;
+    Debugger* PendingStop();
+    /// Marks the other instances' stops as seen after halting all of them.
+    void HaltedTogether();
+    
+    /// Written by NotifyHalted, polled by the stub thread.
+    int wake_fds[2];
+    void DrainWakeups();
+    /// Blocks the stub thread until the emulation thread halts.
+    void WaitForHalt();
     
     std::string address;
     int port;
@@ -109,6 +147,8 @@ class GdbStub {
     
 	// utilities
 	void ReadThreadId(util::Buffer &buffer, int64_t &pid, int64_t &thread_id);
+	void WriteThreadId(int64_t thread_id, util::Buffer &response);
+	void ReadConditionList(util::Buffer &packet, std::vector<AgentExpression> &conditions);
 	
 	// packets
 	void HandleGeneralGetQuery(util::Buffer &packet);
@@ -121,8 +161,10 @@ class GdbStub {
 	void HandleWriteGeneralRegisters(util::Buffer &packet);
 	void HandleSetCurrentThread(util::Buffer &packet);
 	void HandleReadMemory(util::Buffer &packet);
+	void HandleReadMemoryBinary(util::Buffer &packet);
 	void HandleWriteMemory(util::Buffer &packet);
     void HandleBreakpoint(util::Buffer &packet, bool remove = false);
+	void HandleReverse(util::Buffer &packet);
 	
 	// multiletter packets
 	void HandleVAttach(util::Buffer &packet);
@@ -139,19 +181,29 @@ class GdbStub {
 	void QueryGetOffsets(util::Buffer &packet);
 	void QueryGetRemoteCommand(util::Buffer &packet);
 	void QueryXfer(util::Buffer &packet);
+	void QueryGetSearch(util::Buffer &packet);
     void QueryGetTStatus(util::Buffer &packet);
+	void QueryGetTracepointStatus(util::Buffer &packet);
+	void QueryGetEmptyList(util::Buffer &packet);
 	
 	// set queries
 	void QuerySetStartNoAckMode(util::Buffer &packet);
 	void QuerySetThreadEvents(util::Buffer &packet);
+	void QuerySetIgnored(util::Buffer &packet);
+	void QuerySetTraceInit(util::Buffer &packet);
+	void QuerySetTracepoint(util::Buffer &packet);
+	void QuerySetTraceStart(util::Buffer &packet);
+	void QuerySetTraceStop(util::Buffer &packet);
+	void QuerySetTraceFrame(util::Buffer &packet);
 
 	// xfer objects
 	std::string XferReadLibraries();
+	std::string XferReadMemoryMap();
 	ReadOnlyStringXferObject xfer_libraries;
+	ReadOnlyStringXferObject xfer_memory_map;
     FeaturesXferObject xfer_features;
 	
 	bool thread_events_enabled = false;
-    bool sent_thread_info = false;
 };
 
 } // namespace debugger
@@ -0,0 +1,113 @@
+#include "History.h"
+#include "cpu.h"
+#include "savestate.h"
+#include "statesaver.h"
+#include <ctime>
+
+
+namespace gambatte {
+namespace debugger {
+
+History::History(CPU* cpu) : cpu(cpu)
+{
+    
+}
+
+void History::Start(size_t slots, uint64_t interval)
+{
+    SaveState state;
+    cpu->setStatePtrs(state);
+    cpu->saveState(state);
+    
+    this->slot_size = StateSaver::stateSize(state);
+    this->slots = slots;
+    this->interval = interval;
+    storage.reset(new uint8_t[slot_size * slots]);
+    positions.reset(new uint64_t[slots]);
+    inputs.reset(new unsigned[slots]);
+    clocks.reset(new uint64_t[slots]);
+    first = 0;
+    count = 0;
+    input = cpu->mem_.pollInput();
+    clock = std::time(0);
+    cpu->mem_.setClock(&clock);
+}
+
+void History::Stop()
+{
+    cpu->mem_.setClock(nullptr);
+    storage.reset();
+    positions.reset();
+    inputs.reset();
+    clocks.reset();
+    slot_size = 0;
+    slots = 0;
+    first = 0;
+    count = 0;
+}
+
+void History::Reset()
+{
+    if (IsRecording()) {
+        Start(slots, interval);
+    }
+}
+
+void History::Save(uint64_t position)
+{
+    size_t index = (first + count) % slots;
+    if (count == slots) {
+        first = (first + 1) % slots;
+    } else {
+        count++;
+    }
+    
+    SaveState state;
+    cpu->setStatePtrs(state);
+    cpu->saveState(state);
+    StateSaver::saveState(state, Slot(index));
+    positions[index] = position;
+    inputs[index] = input;
+    clocks[index] = clock;
+}
+
+bool History::Find(uint64_t position, uint64_t& found) const
+{
+    for (size_t i = count; i-- > 0;) {
+        size_t index = (first + i) % slots;
+        if (positions[index] <= position) {
+            found = positions[index];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool History::Restore(uint64_t position, uint64_t& restored)
+{
+    for (size_t i = count; i-- > 0;) {
+        size_t index = (first + i) % slots;
+        if (positions[index] > position) {
+            continue;
+        }
+        
+        SaveState state;
+        cpu->setStatePtrs(state);
+        if (!StateSaver::loadState(state, Slot(index))) {
+            return false;
+        }
+        cpu->loadState(state);
+        cpu->mem_.bootloader.choosebank(state.mem.ioamhram.get()[0x150] != 0xFF);
+        
+        // The restored snapshot stays; execution records anew from it.
+        count = i + 1;
+        restored = positions[index];
+        input = inputs[index];
+        clock = clocks[index];
+        return true;
+    }
+    return false;
+}
+
+}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+
+namespace gambatte {
+
+class CPU;
+
+namespace debugger {
+
+/// Ring of savestates used for reverse execution. Every snapshot is tagged
+/// with the number of instructions the debugger had counted when it was
+/// taken. Storage is allocated once in Start; taking and restoring
+/// snapshots afterwards only copies into and out of it.
+///
+/// While recording, the core reads the joypad and the RTC time from here
+/// rather than from the frontend and the wall clock. Both are sampled once
+/// per runFor, a change forces a snapshot, and each snapshot keeps the
+/// values it was taken with, so a replay reads exactly what was recorded.
+class History {
+    
+public:
+    History(CPU* cpu);
+    
+    /// Allocates `slots` snapshots and begins recording. Must run on the
+    /// emulation thread, between instructions.
+    void Start(size_t slots = 64, uint64_t interval = 16384);
+    void Stop();
+    
+    /// Forgets all snapshots, resizing the slots if the state size changed
+    /// (e.g. after a different ROM was loaded).
+    void Reset();
+    
+    bool IsRecording() const { return slot_size != 0; }
+    
+    /// Takes a snapshot if `position` is at least `interval` instructions
+    /// past the newest one, or if `input` or `clock` changed since the last
+    /// call. Only valid at a runFor boundary.
+    void Record(uint64_t position, unsigned input, uint64_t clock)
+    {
+        if (!IsRecording()) {
+            return;
+        }
+        if (count == 0 || position >= Newest() + interval || input != this->input || clock != this->clock) {
+            this->input = input;
+            this->clock = clock;
+            Save(position);
+        }
+    }
+    
+    /// Joypad state and RTC time in effect since the last Record or Restore.
+    unsigned Input() const { return input; }
+    uint64_t Clock() const { return clock; }
+    
+    /// Position of the newest snapshot at or before `position`.
+    bool Find(uint64_t position, uint64_t& found) const;
+    
+    /// Loads the newest snapshot at or before `position` and drops every
+    /// later one, since execution continues from there.
+    bool Restore(uint64_t position, uint64_t& restored);
+    
+    size_t Count() const { return count; }
+    size_t Slots() const { return slots; }
+    uint64_t Oldest() const { return positions[first]; }
+    uint64_t Newest() const { return positions[(first + count - 1) % slots]; }
+    
+private:
+    void Save(uint64_t position);
+    uint8_t* Slot(size_t index) { return storage.get() + index * slot_size; }
+    
+    CPU* cpu;
+    std::unique_ptr<uint8_t[]> storage;
+    std::unique_ptr<uint64_t[]> positions;
+    std::unique_ptr<unsigned[]> inputs;
+    std::unique_ptr<uint64_t[]> clocks;
+    size_t slot_size = 0;
+    size_t slots = 0;
+    size_t first = 0;
+    size_t count = 0;
+    uint64_t interval = 0;
+    unsigned input = 0;
+    uint64_t clock = 0;
+};
+
+}
+}
@@ -0,0 +1,141 @@
+#include "MemoryScan.h"
+
+#include <string.h>
+#include <iomanip>
+
+
+namespace gambatte {
+namespace debugger {
+
+namespace {
+
+#if defined(__GNUC__)
+/// Sixteen bytes compared at once; SSE2 or NEON depending on the target.
+typedef uint8_t Bytes __attribute__((vector_size(16)));
+#endif
+
+/// mask[i] &= keep(now[i], before[i]) for every byte. Returns the number of
+/// candidates left.
+template<typename Keep>
+size_t Apply(uint8_t* mask, const uint8_t* now, const uint8_t* before, size_t size, Keep keep)
+{
+    size_t count = 0;
+    size_t i = 0;
+#if defined(__GNUC__)
+    for (; i + sizeof(Bytes) <= size; i += sizeof(Bytes)) {
+        Bytes m, a, b;
+        memcpy(&m, mask + i, sizeof(m));
+        memcpy(&a, now + i, sizeof(a));
+        memcpy(&b, before + i, sizeof(b));
+        m &= (Bytes)keep(a, b);
+        memcpy(mask + i, &m, sizeof(m));
+        
+        uint64_t words[2];
+        memcpy(words, &m, sizeof(words));
+        count += __builtin_popcountll(words[0] & 0x0101010101010101ull);
+        count += __builtin_popcountll(words[1] & 0x0101010101010101ull);
+    }
+#endif
+    for (; i < size; i++) {
+        mask[i] &= keep(now[i], before[i]) ? 0xff : 0;
+        count += mask[i] & 1;
+    }
+    return count;
+}
+
+}
+
+void MemoryScan::Start(const std::vector<Region>& regions)
+{
+    this->regions = regions;
+    size_t total = 0;
+    for (const Region& region : regions) {
+        total += region.size;
+    }
+    snapshot.resize(total);
+    current.resize(total);
+    mask.assign(total, 0xff);
+    count = total;
+    
+    uint8_t* out = snapshot.data();
+    for (const Region& region : regions) {
+        memcpy(out, region.data, region.size);
+        out += region.size;
+    }
+}
+
+bool MemoryScan::Matches(const std::vector<Region>& regions) const
+{
+    if (regions.size() != this->regions.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < regions.size(); i++) {
+        if (regions[i].data != this->regions[i].data || regions[i].size != this->regions[i].size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MemoryScan::Narrow(const std::vector<Region>& regions, Filter filter, uint8_t value)
+{
+    if (!Started() || !Matches(regions)) {
+        return false;
+    }
+    
+    uint8_t* out = current.data();
+    for (const Region& region : regions) {
+        memcpy(out, region.data, region.size);
+        out += region.size;
+    }
+    
+    uint8_t* m = mask.data();
+    const uint8_t* now = current.data();
+    const uint8_t* before = snapshot.data();
+    size_t size = mask.size();
+    switch (filter) {
+        case Filter::changed:
+            count = Apply(m, now, before, size, [](auto a, auto b) { return a != b; });
+            break;
+        case Filter::unchanged:
+            count = Apply(m, now, before, size, [](auto a, auto b) { return a == b; });
+            break;
+        case Filter::increased:
+            count = Apply(m, now, before, size, [](auto a, auto b) { return a > b; });
+            break;
+        case Filter::decreased:
+            count = Apply(m, now, before, size, [](auto a, auto b) { return a < b; });
+            break;
+        case Filter::equal:
+            count = Apply(m, now, before, size, [value](auto a, auto) { return a == value; });
+            break;
+        case Filter::not_equal:
+            count = Apply(m, now, before, size, [value](auto a, auto) { return a != value; });
+            break;
+    }
+    
+    snapshot.swap(current);
+    return true;
+}
+
+void MemoryScan::List(std::ostream& out, size_t limit) const
+{
+    size_t offset = 0;
+    for (const Region& region : regions) {
+        for (size_t i = 0; i < region.size && limit > 0; i++) {
+            if (!mask[offset + i]) {
+                continue;
+            }
+            size_t bank = i / region.bank_size;
+            long address = (bank ? region.banked_address : region.address) + i % region.bank_size;
+            out << std::hex << "0x" << std::setw(4) << std::setfill('0') << address
+                << " " << region.name << " bank " << std::dec << bank
+                << ": " << (unsigned) snapshot[offset + i] << std::endl;
+            limit--;
+        }
+        offset += region.size;
+    }
+}
+
+}
+}
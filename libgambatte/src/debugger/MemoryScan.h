@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+
+namespace gambatte {
+namespace debugger {
+
+/// Narrows down RAM addresses over a series of snapshots, for finding the
+/// variable behind a value on screen. Every region is copied whole, banks
+/// included, and each pass compares the copies byte for byte.
+class MemoryScan {
+    
+public:
+    struct Region {
+        const char* name;
+        const uint8_t* data;
+        size_t size;
+        size_t bank_size;
+        long address;        ///< where bank 0 is mapped
+        long banked_address; ///< where the other banks are mapped
+    };
+    
+    enum class Filter {
+        changed,
+        unchanged,
+        increased,
+        decreased,
+        equal,      ///< to `value`
+        not_equal   ///< to `value`
+    };
+    
+    /// Takes the first snapshot; every byte is a candidate.
+    void Start(const std::vector<Region>& regions);
+    
+    /// Keeps the candidates whose current value passes `filter` against
+    /// the previous snapshot, then takes a new one. Returns false if the
+    /// regions no longer match the ones the scan was started with.
+    bool Narrow(const std::vector<Region>& regions, Filter filter, uint8_t value = 0);
+    
+    bool Started() const { return !snapshot.empty(); }
+    size_t Count() const { return count; }
+    
+    /// Writes up to `limit` candidates with their snapshot values.
+    void List(std::ostream& out, size_t limit) const;
+    
+private:
+    bool Matches(const std::vector<Region>& regions) const;
+    
+    std::vector<Region> regions;
+    std::vector<uint8_t> snapshot;
+    std::vector<uint8_t> current;
+    
+    /// 0xff for every candidate byte, 0 otherwise.
+    std::vector<uint8_t> mask;
+    size_t count = 0;
+};
+
+}
+}
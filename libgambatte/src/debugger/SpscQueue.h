@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <utility>
+
+namespace gambatte {
+namespace util {
+
+// Bounded lock-free queue for exactly one producer thread and one
+// consumer thread. Capacity must be a power of two; one slot is kept
+// free to tell a full queue from an empty one.
+template<typename T, size_t Capacity>
+class SpscQueue {
+	static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+ public:
+	// Producer side. Returns false if the queue is full.
+	bool Push(T &&item) {
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		size_t next = (tail + 1) & (Capacity - 1);
+		if(next == head_.load(std::memory_order_acquire)) {
+			return false;
+		}
+		items_[tail] = std::move(item);
+		tail_.store(next, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side. Returns false if the queue is empty.
+	bool Pop(T &out) {
+		size_t head = head_.load(std::memory_order_relaxed);
+		if(head == tail_.load(std::memory_order_acquire)) {
+			return false;
+		}
+		out = std::move(items_[head]);
+		head_.store((head + 1) & (Capacity - 1), std::memory_order_release);
+		return true;
+	}
+
+	bool Empty() const {
+		return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+	}
+
+ private:
+	T items_[Capacity];
+	std::atomic<size_t> head_{0};
+	std::atomic<size_t> tail_{0};
+};
+
+} // namespace util
+} // namespace gambatte
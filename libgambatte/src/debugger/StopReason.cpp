@@ -4,8 +4,6 @@
 namespace gambatte {
 namespace debugger {
 
-StopReason* StopReason::BPReason = new StopReason(StopReason::StopType::signal_extended, 5, "swbreak:;thread:p1.1;core:1;");
-
 StopReason::StopReason(StopType type, int code, std::string additional) : type(type), code(code), additional(additional)
 {
     
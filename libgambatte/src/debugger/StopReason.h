@@ -34,7 +34,8 @@ public:
     int code;
     std::string additional;
     
-    static StopReason* BPReason;
+    /// Shown on gdb's console, in an O packet ahead of the stop reply.
+    std::string message;
 };
 
 }
@@ -0,0 +1,157 @@
+#include "Tracepoint.h"
+
+#include <string.h>
+#include <algorithm>
+
+
+namespace gambatte {
+namespace debugger {
+
+namespace {
+
+struct FrameHeader {
+    uint32_t size;
+    uint16_t tracepoint;
+};
+
+/// Addresses keep their bank bits (bank * 0x10000 + 0x4000..0x7fff).
+struct MemoryBlock {
+    uint32_t address;
+    uint16_t length;
+};
+
+}
+
+Tracepoint::Tracepoint(long number, long address) : number(number), address(address)
+{
+    
+}
+
+TraceBuffer::TraceBuffer(size_t size) : data(size)
+{
+    // Worst case is a frame of nothing but its header.
+    frames.reserve(size / sizeof(FrameHeader));
+}
+
+void TraceBuffer::Clear()
+{
+    frames.clear();
+    used = 0;
+}
+
+bool TraceBuffer::Reserve(size_t bytes)
+{
+    return used + bytes <= data.size();
+}
+
+bool TraceBuffer::BeginFrame(long tracepoint)
+{
+    if (!Reserve(sizeof(FrameHeader))) {
+        return false;
+    }
+    frame_start = used;
+    FrameHeader header = { 0, (uint16_t)tracepoint };
+    memcpy(&data[used], &header, sizeof(header));
+    used += sizeof(header);
+    return true;
+}
+
+bool TraceBuffer::AddRegisters(uint32_t mask, const uint32_t* values, size_t count)
+{
+    size_t bytes = 2 + sizeof(mask) + count * sizeof(uint32_t);
+    if (!Reserve(bytes)) {
+        return false;
+    }
+    data[used] = 'R';
+    data[used + 1] = count;
+    memcpy(&data[used + 2], &mask, sizeof(mask));
+    memcpy(&data[used + 2 + sizeof(mask)], values, count * sizeof(uint32_t));
+    used += bytes;
+    return true;
+}
+
+bool TraceBuffer::AddMemory(long address, const uint8_t* bytes, size_t length)
+{
+    MemoryBlock block = { (uint32_t)address, (uint16_t)length };
+    size_t size = 1 + sizeof(block) + length;
+    if (!Reserve(size)) {
+        return false;
+    }
+    data[used] = 'M';
+    memcpy(&data[used + 1], &block, sizeof(block));
+    memcpy(&data[used + 1 + sizeof(block)], bytes, length);
+    used += size;
+    return true;
+}
+
+void TraceBuffer::EndFrame(bool keep)
+{
+    if (!keep) {
+        used = frame_start;
+        return;
+    }
+    uint32_t size = used - frame_start;
+    memcpy(&data[frame_start], &size, sizeof(size));
+    frames.push_back(frame_start);
+}
+
+long TraceBuffer::FrameTracepoint(size_t frame) const
+{
+    FrameHeader header;
+    memcpy(&header, &data[frames[frame]], sizeof(header));
+    return header.tracepoint;
+}
+
+size_t TraceBuffer::BlockSize(size_t pos) const
+{
+    if (data[pos] == 'R') {
+        return 2 + sizeof(uint32_t) + data[pos + 1] * sizeof(uint32_t);
+    }
+    MemoryBlock block;
+    memcpy(&block, &data[pos + 1], sizeof(block));
+    return 1 + sizeof(block) + block.length;
+}
+
+bool TraceBuffer::FrameRegister(size_t frame, size_t index, uint32_t& value) const
+{
+    FrameHeader header;
+    memcpy(&header, &data[frames[frame]], sizeof(header));
+    size_t end = frames[frame] + header.size;
+    for (size_t pos = frames[frame] + sizeof(header); pos < end; pos += BlockSize(pos)) {
+        if (data[pos] != 'R') {
+            continue;
+        }
+        uint32_t mask;
+        memcpy(&mask, &data[pos + 2], sizeof(mask));
+        if (index < data[pos + 1] && (mask >> index & 1)) {
+            memcpy(&value, &data[pos + 2 + sizeof(mask) + index * sizeof(uint32_t)], sizeof(value));
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t TraceBuffer::FrameMemory(size_t frame, long address, size_t length, uint8_t* out) const
+{
+    FrameHeader header;
+    memcpy(&header, &data[frames[frame]], sizeof(header));
+    size_t end = frames[frame] + header.size;
+    for (size_t pos = frames[frame] + sizeof(header); pos < end; pos += BlockSize(pos)) {
+        if (data[pos] != 'M') {
+            continue;
+        }
+        MemoryBlock block;
+        memcpy(&block, &data[pos + 1], sizeof(block));
+        long start = block.address;
+        if (address >= start && address < start + block.length) {
+            size_t copied = std::min(length, (size_t)(start + block.length - address));
+            memcpy(out, &data[pos + 1 + sizeof(block)] + (address - start), copied);
+            return copied;
+        }
+    }
+    return 0;
+}
+
+}
+}
+
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "AgentExpression.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace gambatte {
+namespace debugger {
+
+/// Class used to represent a gdb tracepoint (QTDP): what to collect when
+/// the cpu reaches `address`, without stopping it.
+class Tracepoint {
+    
+public:
+    Tracepoint(long number, long address);
+    
+    struct MemoryRange {
+        long base_register;     ///< -1 for an absolute address
+        long offset;
+        size_t length;
+    };
+    
+    long number;
+    long address;
+    bool enabled = true;
+    
+    /// Stop tracing after this many hits; 0 for no limit.
+    long pass_count = 0;
+    
+    std::vector<AgentExpression> conditions;
+    
+    /// Bit n collects Debugger::Registers[n].
+    uint32_t registers = 0;
+    std::vector<MemoryRange> memory;
+    std::vector<AgentExpression> expressions;
+    
+    long hits = 0;
+    
+private:
+    
+};
+
+/// Frames collected by tracepoints, stored back to back in one buffer
+/// that is allocated when tracing starts and never grows.
+///
+/// A frame is a header followed by blocks. An 'R' block is a register
+/// count, a mask and one uint32 per register. An 'M' block is an address,
+/// a length and that many bytes.
+class TraceBuffer {
+    
+public:
+    TraceBuffer(size_t size);
+    
+    void Clear();
+    
+    /// Frames are built in place. Any Add returning false means the buffer
+    /// is full; the partial frame is then dropped by EndFrame(false).
+    bool BeginFrame(long tracepoint);
+    bool AddRegisters(uint32_t mask, const uint32_t* values, size_t count);
+    bool AddMemory(long address, const uint8_t* bytes, size_t length);
+    void EndFrame(bool keep);
+    
+    size_t Frames() const { return frames.size(); }
+    size_t Size() const { return data.size(); }
+    size_t Used() const { return used; }
+    
+    long FrameTracepoint(size_t frame) const;
+    
+    /// Register `index` of `frame`, if it was collected.
+    bool FrameRegister(size_t frame, size_t index, uint32_t& value) const;
+    
+    /// Copies collected memory starting at `address`, up to the end of the
+    /// block that holds it. Returns the number of bytes copied.
+    size_t FrameMemory(size_t frame, long address, size_t length, uint8_t* out) const;
+    
+private:
+    bool Reserve(size_t bytes);
+    size_t BlockSize(size_t pos) const;
+    
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> frames;
+    size_t used = 0;
+    size_t frame_start = 0;
+};
+
+}
+}
@@ -0,0 +1,168 @@
+#include "Tracer.h"
+#include "cpu.h"
+#include "easylogging++.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+
+
+namespace gambatte {
+namespace debugger {
+
+Tracer::Tracer()
+{
+    memset(&previous, 0, sizeof(previous));
+}
+
+Tracer::~Tracer()
+{
+    Stop();
+}
+
+bool Tracer::Start(const std::string& path, bool delta)
+{
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        LOG(ERROR) << "could not open trace file " << path;
+        return false;
+    }
+    this->path = path;
+    this->delta = delta;
+    
+    uint16_t header[3] = { 1, (uint16_t)(delta ? FlagDelta : 0), (uint16_t)sizeof(TraceRecord) };
+    fwrite("GBTRACE", 1, 8, file);
+    fwrite(header, sizeof(header), 1, file);
+    
+    cycles = 0;
+    started = false;
+    stalls = 0;
+    written = 0;
+    memset(&previous, 0, sizeof(previous));
+    running = true;
+    pthread_create(&writer, NULL, WriterMain, this);
+    return true;
+}
+
+void Tracer::Stop()
+{
+    if (!running) {
+        return;
+    }
+    running = false;
+    pthread_join(writer, NULL);
+    fclose(file);
+    file = nullptr;
+}
+
+void Tracer::Record(CPU& cpu)
+{
+    if (started) {
+        cycles += cpu.cycleCounter_ - last_cc;
+    }
+    started = true;
+    last_cc = cpu.cycleCounter_;
+    
+    TraceRecord record;
+    record.cycles = cycles;
+    record.pc = cpu.correct_pc;
+    record.sp = cpu.sp;
+    record.bank = cpu.mem_.rombank();
+    record.opcode = cpu.mem_.peek(cpu.correct_pc);
+    record.a = cpu.a_;
+    record.f = cpu.f();
+    record.b = cpu.b;
+    record.c = cpu.c;
+    record.d = cpu.d;
+    record.e = cpu.e;
+    record.h = cpu.h;
+    record.l = cpu.l;
+    record.reserved = 0;
+    
+    // Never drop records; wait for the writer instead.
+    while (!ring.Push(std::move(record))) {
+        stalls++;
+        sched_yield();
+    }
+}
+
+void* Tracer::WriterMain(void* ctx)
+{
+    ((Tracer*)ctx)->Drain();
+    return NULL;
+}
+
+void Tracer::Drain()
+{
+    static const size_t batch = 4096;
+    uint8_t out[batch * (sizeof(TraceRecord) + 16)];
+    
+    for (;;) {
+        bool stopping = !running;
+        size_t size = 0;
+        size_t count = 0;
+        TraceRecord record;
+        while (count < batch && ring.Pop(record)) {
+            size += Encode(record, out + size);
+            count++;
+        }
+        if (count != 0) {
+            fwrite(out, 1, size, file);
+            written += count;
+        } else if (stopping) {
+            break;
+        } else {
+            usleep(1000);
+        }
+    }
+    fflush(file);
+}
+
+size_t Tracer::Encode(const TraceRecord& record, uint8_t* out)
+{
+    if (!delta) {
+        memcpy(out, &record, sizeof(record));
+        return sizeof(record);
+    }
+    
+    uint8_t* p = out + 2;
+    uint64_t cycle_delta = record.cycles - previous.cycles;
+    do {
+        uint8_t byte = cycle_delta & 0x7f;
+        cycle_delta >>= 7;
+        *p++ = byte | (cycle_delta ? 0x80 : 0);
+    } while (cycle_delta);
+    
+    uint16_t mask = 0;
+    const uint8_t regs[8] = { record.a, record.f, record.b, record.c, record.d, record.e, record.h, record.l };
+    const uint8_t previous_regs[8] = { previous.a, previous.f, previous.b, previous.c, previous.d, previous.e, previous.h, previous.l };
+    if (record.pc != previous.pc) {
+        mask |= 1 << 0;
+        memcpy(p, &record.pc, 2); p += 2;
+    }
+    if (record.opcode != previous.opcode) {
+        mask |= 1 << 1;
+        *p++ = record.opcode;
+    }
+    for (int i = 0; i < 8; i++) {
+        if (regs[i] != previous_regs[i]) {
+            mask |= 1 << (2 + i);
+            *p++ = regs[i];
+        }
+    }
+    if (record.sp != previous.sp) {
+        mask |= 1 << 10;
+        memcpy(p, &record.sp, 2); p += 2;
+    }
+    if (record.bank != previous.bank) {
+        mask |= 1 << 11;
+        memcpy(p, &record.bank, 2); p += 2;
+    }
+    memcpy(out, &mask, 2);
+    
+    previous = record;
+    return p - out;
+}
+
+}
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "SpscQueue.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+
+namespace gambatte {
+
+class CPU;
+
+namespace debugger {
+
+/// One executed instruction, captured before it runs.
+struct TraceRecord {
+    uint64_t cycles;    ///< cpu cycles since tracing started
+    uint16_t pc;
+    uint16_t sp;
+    uint16_t bank;      ///< ROM bank mapped at 0x4000
+    uint8_t opcode;
+    uint8_t a, f, b, c, d, e, h, l;
+    uint8_t reserved;
+};
+
+/// Streams TraceRecords to a file. The emulation thread pushes records
+/// into a lock-free ring and a writer thread drains it, so the only cost
+/// on the emulation side is filling in the record.
+///
+/// File layout: the 8 byte magic "GBTRACE\0", then little-endian uint16
+/// version, flags and record size. Without FlagDelta every record follows
+/// as a raw TraceRecord. With FlagDelta a record is a uint16 mask of the
+/// fields that changed since the previous one (bit order: pc, opcode, a,
+/// f, b, c, d, e, h, l, sp, bank), the cycle delta as an LEB128 varint,
+/// and then only the changed fields.
+class Tracer {
+    
+public:
+    enum { FlagDelta = 1 };
+    
+    Tracer();
+    ~Tracer();
+    
+    bool Start(const std::string& path, bool delta);
+    void Stop();
+    
+    /// Emulation thread only.
+    void Record(CPU& cpu);
+    
+    /// The core occasionally moves its cycle counter back; keeps the
+    /// recorded cycle count monotonic across that.
+    void Rebase(unsigned long old_cc, unsigned long new_cc) { last_cc -= old_cc - new_cc; }
+    
+    uint64_t Written() const { return written; }
+    uint64_t Stalls() const { return stalls; }
+    std::string Path() const { return path; }
+    
+private:
+    static void* WriterMain(void* ctx);
+    void Drain();
+    size_t Encode(const TraceRecord& record, uint8_t* out);
+    
+    util::SpscQueue<TraceRecord, 1 << 16> ring;
+    FILE* file = nullptr;
+    std::string path;
+    bool delta = false;
+    pthread_t writer;
+    std::atomic<bool> running{false};
+    
+    // Emulation thread.
+    uint64_t cycles = 0;
+    unsigned long last_cc = 0;
+    bool started = false;
+    uint64_t stalls = 0;
+    
+    // Writer thread.
+    TraceRecord previous;
+    std::atomic<uint64_t> written{0};
+};
+
+}
+}
@@ -0,0 +1,43 @@
+
+#include "Watchpoint.h"
+
+
+namespace gambatte {
+namespace debugger {
+
+Watchpoint::Watchpoint(long address, size_t length, Type type) : address(address), length(length), type(type)
+{
+    
+}
+
+bool Watchpoint::Matches(long address, bool write) const
+{
+    if (!enabled || address < this->address || address >= this->address + (long)length) {
+        return false;
+    }
+    switch (type) {
+        case Type::write:
+            return write;
+        case Type::read:
+            return !write;
+        case Type::access:
+            return true;
+    }
+    return false;
+}
+
+const char* Watchpoint::StopKey() const
+{
+    switch (type) {
+        case Type::write:
+            return "watch";
+        case Type::read:
+            return "rwatch";
+        case Type::access:
+            return "awatch";
+    }
+    return "awatch";
+}
+
+}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace gambatte {
+namespace debugger {
+
+/// Class used to represent a data watchpoint (gdb Z2/Z3/Z4).
+class Watchpoint {
+    
+public:
+    enum class Type {
+        write,
+        read,
+        access
+    };
+    
+    Watchpoint(long address, size_t length, Type type);
+    
+    bool Matches(long address, bool write) const;
+    
+    /// Key used in the stop reply, e.g. "rwatch".
+    const char* StopKey() const;
+    
+    long address;
+    size_t length;
+    Type type;
+    bool enabled = true;
+
+private:
+
+};
+
+}
+}
+
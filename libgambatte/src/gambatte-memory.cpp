@@ -22,6 +22,8 @@
 #include "sound.h"
 #include "video.h"
 #include "bootloader.h"
+#include "debugger/Debugger.h"
+#include <algorithm>
 #include <cstring>
 
 namespace gambatte {
@@ -32,6 +34,10 @@ Memory::Memory(Interrupter const &interrupter) :
 , serialize_is_fastcgb_(false),
 #endif
    getInput_(0)
+, debugger_(0)
+, coverage_(0)
+, coverageMask_(0)
+, coveragePrev_(0)
 #ifdef HAVE_NETWORK
 , serial_io_(0)
 #endif
@@ -44,9 +50,14 @@ Memory::Memory(Interrupter const &interrupter) :
 , oamDmaPos_(0xFE)
 , serialCnt_(0)
 , blanklcd_(false)
+#ifdef GAMBATTE_PROFILE
+, profile_()
+#endif
 {
 	intreq_.setEventTime<intevent_blit>(144 * 456ul);
 	intreq_.setEventTime<intevent_end>(0);
+	PROFILE(lcd_.setProfileCounter(&profile_.lcdNs));
+	PROFILE(psg_.setProfileCounter(&profile_.psgNs));
 }
 
 void Memory::setStatePtrs(SaveState &state) {
@@ -93,6 +104,7 @@ void Memory::loadState(SaveState const &state) {
 	lcd_.loadState(state, state.mem.oamDmaPos < 0xA0 ? cart_.rdisabledRam() : ioamhram_);
 	tima_.loadState(state, TimaInterruptRequester(intreq_));
 	cart_.loadState(state);
+	cart_.setAllDirty();
 	intreq_.loadState(state);
 
 	divLastUpdate_ = state.mem.divLastUpdate;
@@ -177,6 +189,8 @@ void Memory::checkSerial(unsigned long const cc) {
 
 void Memory::updateSerial(unsigned long const cc) {
 	if (intreq_.eventTime(intevent_serial) != disabled_time) {
+		cart_.setHramDirty();
+
 		if (intreq_.eventTime(intevent_serial) <= cc) {
 #ifdef HAVE_NETWORK
 			bool fire = ((ioamhram_[0x102] & 0x80) == 0x80);
@@ -225,6 +239,8 @@ void Memory::updateIrqs(unsigned long cc) {
 }
 
 unsigned long Memory::event(unsigned long cc) {
+	PROFILE(++profile_.events[intreq_.minEventId()]);
+
 	if (lastOamDmaUpdate_ != disabled_time)
 		updateOamDma(cc);
 
@@ -284,6 +300,7 @@ unsigned long Memory::event(unsigned long cc) {
 			if ((static_cast<unsigned long>(dmaDest) + length) & 0x10000) {
 				length = 0x10000 - dmaDest;
 				ioamhram_[0x155] |= 0x80;
+				cart_.setHramDirty();
 			}
 
 			dmaLength -= length;
@@ -312,6 +329,7 @@ unsigned long Memory::event(unsigned long cc) {
 								startOamDma(lOamDmaUpdate - 1);
 
 							ioamhram_[src & 0xFF] = data;
+							cart_.setOamDirty();
 						} else if (oamDmaPos_ == 0xA0) {
 							endOamDma(lOamDmaUpdate - 1);
 							lOamDmaUpdate = disabled_time;
@@ -329,6 +347,7 @@ unsigned long Memory::event(unsigned long cc) {
 			dmaSource_ = dmaSrc;
 			dmaDestination_ = dmaDest;
 			ioamhram_[0x155] = ((dmaLength / 0x10 - 0x1) & 0xFF) | (ioamhram_[0x155] & 0x80);
+			cart_.setHramDirty();
 
 			if ((ioamhram_[0x155] & 0x80) && lcd_.hdmaIsEnabled()) {
 				if (lastOamDmaUpdate_ != disabled_time)
@@ -366,6 +385,11 @@ unsigned long Memory::event(unsigned long cc) {
 
 			intreq_.ackIrq(n);
 			cc = interrupter_.interrupt(address, cc, *this);
+			if (coverage_)
+				coverEdge(address);
+
+			if (debugger_->catch_interrupts & n)
+				debugger_->CatchInterrupt(n, address);
 		}
 
 		break;
@@ -381,6 +405,7 @@ unsigned long Memory::stop(unsigned long cc) {
 		psg_.generateSamples(cc, isDoubleSpeed());
 		lcd_.speedChange(cc);
 		ioamhram_[0x14D] ^= 0x81;
+		cart_.setHramDirty();
 		intreq_.setEventTime<intevent_blit>((ioamhram_[0x140] & lcdc_en)
 			? lcd_.nextMode1IrqTime()
 			: cc + (70224 << isDoubleSpeed()));
@@ -418,6 +443,7 @@ unsigned long Memory::resetCounters(unsigned long cc) {
 		unsigned long divinc = (cc - divLastUpdate_) >> 8;
 		ioamhram_[0x104] = (ioamhram_[0x104] + divinc) & 0xFF;
 		divLastUpdate_ += divinc << 8;
+		cart_.setHramDirty();
 	}
 
 	unsigned long const dec = cc < 0x10000
@@ -440,11 +466,18 @@ unsigned long Memory::resetCounters(unsigned long cc) {
 	return cc;
 }
 
+unsigned Memory::pollInput() {
+	return getInput_ ? (*getInput_)() : 0;
+}
+
 void Memory::updateInput() {
 	unsigned state = 0xF;
 
 	if ((ioamhram_[0x100] & 0x30) != 0x30 && getInput_) {
-		unsigned input = (*getInput_)();
+		// Reverse execution replays the input its snapshots were taken with.
+		unsigned input = debugger_->history.IsRecording()
+		               ? debugger_->history.Input()
+		               : (*getInput_)();
 		unsigned dpad_state = ~input >> 4;
 		unsigned button_state = ~input;
 		if (!(ioamhram_[0x100] & 0x10))
@@ -457,6 +490,7 @@ void Memory::updateInput() {
 		intreq_.flagIrq(0x10);
 
 	ioamhram_[0x100] = (ioamhram_[0x100] & -0x10u) | state;
+	cart_.setHramDirty();
 }
 
 void Memory::updateOamDma(unsigned long const cc) {
@@ -475,6 +509,8 @@ void Memory::updateOamDma(unsigned long const cc) {
 			else if (cart_.isHuC3()) ioamhram_[oamDmaPos_] = cart_.HuC3Read(oamDmaPos_, cc);
 			else ioamhram_[oamDmaPos_] = cart_.rtcRead();
 
+			cart_.setOamDirty();
+
 		} else if (oamDmaPos_ == 0xA0) {
 			endOamDma(lastOamDmaUpdate_ - 1);
 			lastOamDmaUpdate_ = disabled_time;
@@ -526,6 +562,11 @@ void Memory::endOamDma(unsigned long cc) {
 }
 
 unsigned Memory::nontrivial_ff_read(unsigned const p, unsigned long const cc) {
+	if (cart_.isReadTrapped(0xF))
+		debugger_->CheckForWatchpoints(0xFF00 | p, false);
+
+	PROFILE(++profile_.ioReads[p & 0xFF]);
+
 	if (lastOamDmaUpdate_ != disabled_time)
 		updateOamDma(cc);
 
@@ -542,15 +583,18 @@ unsigned Memory::nontrivial_ff_read(unsigned const p, unsigned long const cc) {
 			unsigned long divcycles = (cc - divLastUpdate_) >> 8;
 			ioamhram_[0x104] = (ioamhram_[0x104] + divcycles) & 0xFF;
 			divLastUpdate_ += divcycles << 8;
+			cart_.setHramDirty();
 		}
 
 		break;
 	case 0x05:
 		ioamhram_[0x105] = tima_.tima(cc);
+		cart_.setHramDirty();
 		break;
 	case 0x0F:
 		updateIrqs(cc);
 		ioamhram_[0x10F] = intreq_.ifreg();
+		cart_.setHramDirty();
 		break;
 	case 0x26:
 		if (ioamhram_[0x126] & 0x80) {
@@ -559,6 +603,7 @@ unsigned Memory::nontrivial_ff_read(unsigned const p, unsigned long const cc) {
 		} else
 			ioamhram_[0x126] = 0x70;
 
+		cart_.setHramDirty();
 		break;
 	case 0x30:
 	case 0x31:
@@ -620,6 +665,18 @@ static bool isInOamDmaConflictArea(OamDmaSrc const oamDmaSrc, unsigned const p,
 }
 
 unsigned Memory::nontrivial_read(unsigned const p, unsigned long const cc) {
+	// Plain memory the 4K areas can't map: WRAM echo pages, and HRAM as in
+	// ff_read. Kept out of the inline read so that the cpu loop stays small.
+	if (cart_.rpage(p >> 8))
+		return cart_.rpage(p >> 8)[p];
+	if (p - 0xFF80u < 0x7Fu && !cart_.isReadTrapped(0xF))
+		return ioamhram_[p - 0xFE00];
+
+	if (cart_.isReadTrapped(p >> 12))
+		debugger_->CheckForWatchpoints(p, false);
+
+	PROFILE(++profile_.pageReads[p >> 8]);
+
 	if (p < 0xFF80) {
 		if (lastOamDmaUpdate_ != disabled_time) {
 			updateOamDma(cc);
@@ -662,7 +719,76 @@ unsigned Memory::nontrivial_read(unsigned const p, unsigned long const cc) {
 	return ioamhram_[p - 0xFE00];
 }
 
+unsigned char const * Memory::peekArea(unsigned const p, unsigned &areaEnd) const {
+	// Returns a pointer that can be indexed by the address itself, valid up
+	// to areaEnd, or null if the area has no plain backing storage.
+	if (p < 0x8000) {
+		areaEnd = (p & 0x4000) + 0x4000;
+		return cart_.romdata(p >> 14);
+	}
+
+	if (p < 0xA000) {
+		areaEnd = 0xA000;
+		return cart_.vrambankptr();
+	}
+
+	if (p < 0xC000) {
+		areaEnd = 0xC000;
+		return cart_.rsrambankptr();
+	}
+
+	if (p < 0xFE00) {
+		areaEnd = std::min((p & 0xF000) + 0x1000, 0xFE00u);
+		return cart_.wramdata(p >> 12 & 1) - (p & 0xF000);
+	}
+
+	areaEnd = 0x10000;
+	return ioamhram_ - 0xFE00;
+}
+
+unsigned Memory::peek(unsigned const p) const {
+	unsigned areaEnd;
+	if (unsigned char const *const area = peekArea(p, areaEnd))
+		return area[p];
+
+	return cart_.isHuC3() ? 0xFF : cart_.rtcRead();
+}
+
+void Memory::peek(unsigned char *dest, unsigned p, std::size_t n) const {
+	while (n && p < 0x10000) {
+		unsigned areaEnd;
+		unsigned char const *const area = peekArea(p, areaEnd);
+		std::size_t const len = std::min<std::size_t>(n, areaEnd - p);
+
+		if (area) {
+			std::memcpy(dest, area + p, len);
+		} else
+			std::memset(dest, peek(p), len);
+
+		dest += len;
+		p += len;
+		n -= len;
+	}
+}
+
+bool Memory::peekRombank(unsigned char *dest, unsigned bank, unsigned p, std::size_t n) const {
+	if (bank >= cart_.rombanks() || p < 0x4000 || p + n > 0x8000)
+		return false;
+
+	std::memcpy(dest, cart_.rombankdata(bank) + (p - 0x4000), n);
+	return true;
+}
+
 void Memory::nontrivial_ff_write(unsigned const p, unsigned data, unsigned long const cc) {
+	if (cart_.isWriteTrapped(0xF))
+		debugger_->CheckForWatchpoints(0xFF00 | p, true);
+
+	PROFILE(++profile_.ioWrites[p & 0xFF]);
+	cart_.setHramDirty();
+
+	if (debugger_->catch_io[p & 0xFF])
+		debugger_->CatchIoWrite(p & 0xFF, ioamhram_[p + 0x100], data);
+
 	if (lastOamDmaUpdate_ != disabled_time)
 		updateOamDma(cc);
 
@@ -1119,12 +1245,40 @@ void Memory::nontrivial_ff_write(unsigned const p, unsigned data, unsigned long
 	ioamhram_[p + 0x100] = data;
 }
 
+void Memory::mbcWriteCaught(unsigned const p, unsigned const data) {
+	unsigned const oldRombank = cart_.rombank();
+	unsigned char const *const oldRambank = cart_.rsrambankptr();
+	cart_.mbcWrite(p, data);
+
+	if (cart_.rombank() != oldRombank)
+		debugger_->CatchBankSwitch(p, data, oldRombank, cart_.rombank(), true);
+	else if (cart_.rsrambankptr() != oldRambank)
+		debugger_->CatchBankSwitch(p, data, 0, 0, false);
+}
+
 void Memory::nontrivial_write(unsigned const p, unsigned const data, unsigned long const cc) {
+	if (unsigned char *const page = cart_.wpage(p >> 8)) {
+		page[p] = data;
+		cart_.setDirty(page + p);
+		return;
+	}
+	if (p - 0xFF80u < 0x7Fu && !cart_.isWriteTrapped(0xF)) {
+		ioamhram_[p - 0xFE00] = data;
+		cart_.setHramDirty();
+		return;
+	}
+
+	if (cart_.isWriteTrapped(p >> 12))
+		debugger_->CheckForWatchpoints(p, true);
+
+	PROFILE(++profile_.pageWrites[p >> 8]);
+
 	if (lastOamDmaUpdate_ != disabled_time) {
 		updateOamDma(cc);
 
 		if (isInOamDmaConflictArea(cart_.oamDmaSrc(), p, isCgb()) && oamDmaPos_ < 0xA0) {
 			ioamhram_[oamDmaPos_] = data;
+			cart_.setOamDirty();
 			return;
 		}
 	}
@@ -1132,31 +1286,41 @@ void Memory::nontrivial_write(unsigned const p, unsigned const data, unsigned lo
 	if (p < 0xFE00) {
 		if (p < 0xA000) {
 			if (p < 0x8000) {
-				cart_.mbcWrite(p, data);
+				if (debugger_->catch_bank)
+					mbcWriteCaught(p, data);
+				else
+					cart_.mbcWrite(p, data);
 			} else if (lcd_.vramAccessible(cc)) {
 				lcd_.vramChange(cc);
 				cart_.vrambankptr()[p] = data;
+				cart_.setDirty(cart_.vrambankptr() + p);
 			}
 		} else if (p < 0xC000) {
-			if (cart_.wsrambankptr())
+			if (cart_.wsrambankptr()) {
 				cart_.wsrambankptr()[p] = data;
-			else if (cart_.isHuC3())
+				cart_.setDirty(cart_.wsrambankptr() + p);
+			} else if (cart_.isHuC3())
 				cart_.HuC3Write(p, data);
 			else
 				cart_.rtcWrite(data);
-		} else
+		} else {
 			cart_.wramdata(p >> 12 & 1)[p & 0xFFF] = data;
+			cart_.setDirty(cart_.wramdata(p >> 12 & 1) + (p & 0xFFF));
+		}
 	} else if (p - 0xFF80u >= 0x7Fu) {
 		long const ffp = long(p) - 0xFF00;
 		if (ffp < 0) {
 			if (lcd_.oamWritable(cc) && oamDmaPos_ >= 0xA0 && (p < 0xFEA0 || isCgb())) {
 				lcd_.oamChange(cc);
 				ioamhram_[p - 0xFE00] = data;
+				cart_.setOamDirty();
 			}
 		} else
 			nontrivial_ff_write(ffp, data, cc);
-	} else
+	} else {
 		ioamhram_[p - 0xFE00] = data;
+		cart_.setHramDirty();
+	}
 }
 
 std::size_t Memory::fillSoundBuffer(unsigned long cc) {
@@ -25,10 +25,12 @@
 #include "sound.h"
 #include "tima.h"
 #include "video.h"
+#include "profile.h"
 
 namespace gambatte {
 
 class InputGetter;
+namespace debugger { class Debugger; }
 #ifdef HAVE_NETWORK
 class SerialIO;
 #endif
@@ -58,8 +60,9 @@ public:
    void *rambank1_ptr() const { return cart_.wramdata(0) + 0x1000; }
    void *rambank2_ptr() const { return cart_.wramdata(0) + 0x2000; }
    void *bankedram_ptr() const { return cart_.wramdata(1); }
-   void *rombank0_ptr() const { return cart_.romdata(0); }
-   void *rombank1_ptr() const { return cart_.romdata(0) + 0x4000; }
+   // ROM is shared between instances, these must only be read through.
+   void *rombank0_ptr() const { return const_cast<unsigned char *>(cart_.romdata(0)); }
+   void *rombank1_ptr() const { return const_cast<unsigned char *>(cart_.rombankdata(1 % cart_.rombanks())); }
    void *zeropage_ptr() const { return (void*)(ioamhram_ + 0x0180); }
    void *oamram_ptr() const { return (void*)ioamhram_; }
 #else
@@ -86,6 +89,41 @@ public:
 	void ei(unsigned long cycleCounter) { if (!ime()) { intreq_.ei(cycleCounter); } }
 	void di() { intreq_.di(); }
 
+	// Debugger access straight from the backing storage, bypassing the
+	// I/O, PPU access-timing and OAM DMA logic of read().
+	unsigned peek(unsigned p) const;
+	void peek(unsigned char *dest, unsigned p, std::size_t n) const;
+	// Reads from any ROM bank as if it were mapped at 0x4000-0x7FFF.
+	bool peekRombank(unsigned char *dest, unsigned bank, unsigned p, std::size_t n) const;
+	unsigned rombank() const { return cart_.rombank(); }
+	unsigned rombanks() const { return cart_.rombanks(); }
+	// Private copy of the ROM bank mapped at 0x0000-0x3FFF, for the bootloader.
+	unsigned char * writableRombank0() { return cart_.writableRombank0(); }
+	// Backing storage of every WRAM and cartridge RAM bank, and of HRAM.
+	unsigned char const * wramdata() const { return cart_.wramdata(0); }
+	std::size_t wramsize() const { return cart_.wramdataend() - cart_.wramdata(0); }
+	unsigned char const * sramdata() const { return cart_.rambankdata(); }
+	std::size_t sramsize() const { return cart_.rambankdataend() - cart_.rambankdata(); }
+	unsigned char const * hramdata() const { return ioamhram_ + 0x180; }
+
+	// 256-byte pages of VRAM, SRAM and WRAM followed by one page each for
+	// OAM and 0xFF00-0xFFFF, flagged on write once trackDirty was called.
+	std::size_t dirtyPages() const { return cart_.dirtyPages(); }
+	void trackDirty() { cart_.trackDirty(); }
+	void takeDirty(unsigned long long *bitmap) { cart_.takeDirty(bitmap); }
+	std::size_t sramPage() const { return (cart_.rambankdata() - cart_.vramdata()) >> 8; }
+	std::size_t wramPage() const { return (cart_.wramdata(0) - cart_.vramdata()) >> 8; }
+
+#ifdef GAMBATTE_PROFILE
+	Profile & profile() { return profile_; }
+#endif
+
+	// Plain ROM and RAM pages read without side effects and only change
+	// through writes. Returns -1 for anything else.
+	int plainRead(unsigned p) const {
+		return cart_.rmem(p >> 12) ? cart_.rmem(p >> 12)[p] : -1;
+	}
+
 	unsigned ff_read(unsigned p, unsigned long cc) {
 		return p < 0x80 ? nontrivial_ff_read(p, cc) : ioamhram_[p + 0x100];
 	}
@@ -97,6 +135,7 @@ public:
 	void write(unsigned p, unsigned data, unsigned long cc) {
 		if (cart_.wmem(p >> 12)) {
 			cart_.wmem(p >> 12)[p] = data;
+			cart_.setDirty(cart_.wmem(p >> 12) + p);
 		} else
 			nontrivial_write(p, data, cc);
 	}
@@ -104,6 +143,7 @@ public:
 	void ff_write(unsigned p, unsigned data, unsigned long cc) {
 		if (p - 0x80u < 0x7Fu) {
 			ioamhram_[p + 0x100] = data;
+			cart_.setHramDirty();
 		} else
 			nontrivial_ff_write(p, data, cc);
 	}
@@ -115,6 +155,10 @@ public:
 	unsigned long resetCounters(unsigned long cycleCounter);
 	void setSaveDir(std::string const &dir) { cart_.setSaveDir(dir); }
 	void setInputGetter(InputGetter *getInput) { getInput_ = getInput; }
+	// Buttons currently held according to the frontend.
+	unsigned pollInput();
+	// Takes the RTC time from *clock instead of the wall clock while set.
+	void setClock(uint64_t const *clock) { cart_.setClock(clock); }
 #ifdef HAVE_NETWORK
 	void setSerialIO(SerialIO* serial_io) { serial_io_ = serial_io; }
 #endif
@@ -130,6 +174,26 @@ public:
 		lcd_.setDmgPaletteColor(palNum, colorNum, rgb32);
 	}
 
+	void setDebugger(debugger::Debugger *debugger) { debugger_ = debugger; }
+	void setWatchedAreas(unsigned readAreas, unsigned writeAreas) { cart_.setTraps(readAreas, writeAreas); }
+
+	// Edge coverage (AFL style): the previous and the new jump target, with
+	// the ROM bank for targets in 0x4000-0x7FFF, hash to an 8-bit hit counter.
+	// size must be a power of two; 0 turns it off.
+	void setCoverage(unsigned char *map, std::size_t size) {
+		coverage_ = size ? map : 0;
+		coverageMask_ = size ? size - 1 : 0;
+		coveragePrev_ = 0;
+	}
+	void clearCoveragePath() { coveragePrev_ = 0; }
+	bool coverage() const { return coverage_; }
+	void coverEdge(unsigned to) {
+		unsigned const bank = (to & 0xC000) == 0x4000 ? cart_.rombank() : 0;
+		unsigned const loc = (to | bank << 16) * 2654435761u >> 8;
+		++coverage_[(loc ^ coveragePrev_) & coverageMask_];
+		coveragePrev_ = loc >> 1;
+	}
+
 	void setGameGenie(std::string const &codes) { cart_.setGameGenie(codes); }
 	void setGameShark(std::string const &codes) { interrupter_.setGameShark(codes); }
 #ifdef HAVE_NETWORK
@@ -148,6 +212,10 @@ private:
 	SerialIO *serial_io_;
 #endif
 	InputGetter *getInput_;
+	debugger::Debugger *debugger_;
+	unsigned char *coverage_;
+	std::size_t coverageMask_;
+	unsigned coveragePrev_;
 	unsigned long divLastUpdate_;
 	unsigned long lastOamDmaUpdate_;
 	InterruptRequester intreq_;
@@ -160,6 +228,9 @@ private:
 	unsigned char oamDmaPos_;
 	unsigned char serialCnt_;
 	bool blanklcd_;
+#ifdef GAMBATTE_PROFILE
+	Profile profile_;
+#endif
 
 	void decEventCycles(IntEventId eventId, unsigned long dec);
 	void oamDmaInitSetup();
@@ -167,9 +238,11 @@ private:
 	void startOamDma(unsigned long cycleCounter);
 	void endOamDma(unsigned long cycleCounter);
 	unsigned char const * oamDmaSrcPtr() const;
+	unsigned char const * peekArea(unsigned p, unsigned &areaEnd) const;
 	unsigned nontrivial_ff_read(unsigned p, unsigned long cycleCounter);
 	unsigned nontrivial_read(unsigned p, unsigned long cycleCounter);
 	void nontrivial_ff_write(unsigned p, unsigned data, unsigned long cycleCounter);
+	void mbcWriteCaught(unsigned p, unsigned data);
 	void nontrivial_write(unsigned p, unsigned data, unsigned long cycleCounter);
 	void updateSerial(unsigned long cc);
 	void updateTimaIrq(unsigned long cc);
@@ -23,22 +23,56 @@
 #include "initstate.h"
 #include "bootloader.h"
 #include <sstream>
+#include <algorithm>
 #include <cstring>
+#include <mutex>
+#include <vector>
 
 namespace gambatte {
 struct GB::Priv {
 	CPU cpu;
 	int stateNo;
 	bool gbaCgbMode;
+	unsigned char *coverage;
+	std::size_t coverageSize;
+	std::vector<unsigned char> ownCoverage;
+	// Dirty pages go to two consumers, takeDirtyPages and delta states,
+	// each clearing only its own copy.
+	std::mutex dirtyMutex;
+	std::vector<unsigned long long> dirtyPages;
+	std::vector<unsigned long long> deltaPages;
+	std::vector<unsigned long long> takenPages;
 	
-	Priv() : stateNo(1), gbaCgbMode(false) {}
+	Priv() : stateNo(1), gbaCgbMode(false), coverage(0), coverageSize(0) {}
 
    void full_init();
+   void collectDirtyPages();
+   void restartDeltas();
 };
+
+void GB::Priv::collectDirtyPages() {
+	cpu.mem_.takeDirty(&takenPages[0]);
+
+	for (std::size_t i = 0; i < takenPages.size(); ++i) {
+		dirtyPages[i] |= takenPages[i];
+		deltaPages[i] |= takenPages[i];
+	}
+}
+
+// the current state becomes the base of the next delta
+void GB::Priv::restartDeltas() {
+	if (!cpu.mem_.loaded())
+		return;
+
+	std::lock_guard<std::mutex> lock(dirtyMutex);
+	collectDirtyPages();
+	std::fill(deltaPages.begin(), deltaPages.end(), 0);
+}
 	
 GB::GB() : p_(new Priv) {
     debugger = new debugger::Debugger(&p_->cpu);
     p_->cpu.debugger = debugger;
+    p_->cpu.mem_.setDebugger(debugger);
 }
 
 GB::~GB() {
@@ -47,6 +81,7 @@ GB::~GB() {
 
 long GB::runFor(gambatte::video_pixel_t *const videoBuf, const int pitch,
 			gambatte::uint_least32_t *const soundBuf, unsigned &samples) {
+	std::lock_guard<std::mutex> machine(debugger->machine);
 	
 	p_->cpu.setVideoBuffer(videoBuf, pitch);
 	p_->cpu.setSoundBuffer(soundBuf);
@@ -63,10 +98,11 @@ void GB::Priv::full_init() {
    setInitState(state, cpu.isCgb(), gbaCgbMode);
    
    cpu.mem_.bootloader.reset();
-   cpu.mem_.bootloader.set_address_space_start((void*)cpu.rombank0_ptr());
    cpu.mem_.bootloader.load(cpu.isCgb(), gbaCgbMode);
 
    if (cpu.mem_.bootloader.using_bootloader) {
+      // only copy ROM bank 0 out of the shared image when a bootloader is mapped over it
+      cpu.mem_.bootloader.map(cpu.mem_.writableRombank0());
       uint8_t *ioamhram = (uint8_t*)state.mem.ioamhram.get();
       uint8_t serialctrl = (cpu.isCgb() || gbaCgbMode) ? 0x7C : 0x7E;
       state.cpu.pc = 0x0000;
@@ -83,6 +119,7 @@ void GB::Priv::full_init() {
 }
 
 void GB::reset() {
+   std::lock_guard<std::mutex> machine(debugger->machine);
    p_->full_init();
 }
 
@@ -106,12 +143,23 @@ void *GB::rtcdata_ptr() { return p_->cpu.rtcdata_ptr(); }
 unsigned GB::rtcdata_size() { return p_->cpu.rtcdata_size(); }
 
 int GB::load(const void *romdata, unsigned romsize, const unsigned flags) {
+	std::lock_guard<std::mutex> machine(debugger->machine);
 	const int failed = p_->cpu.load(romdata, romsize, flags & (FORCE_DMG | FORCE_CGB), flags & MULTICART_COMPAT);
 	
    if (!failed) {
+      {
+         std::lock_guard<std::mutex> lock(p_->dirtyMutex);
+         std::size_t const words = (p_->cpu.mem_.dirtyPages() + 63) / 64;
+         p_->dirtyPages.assign(words, 0);
+         p_->deltaPages.assign(words, 0);
+         p_->takenPages.assign(words, 0);
+      }
+
       p_->gbaCgbMode = flags & GBA_CGB;
       p_->full_init();
       p_->stateNo = 1;
+      p_->cpu.clearIdleLoopStats();
+      debugger->history.Reset();
    }
 	
 	return failed;
@@ -130,29 +178,166 @@ void GB::setDmgPaletteColor(unsigned palNum, unsigned colorNum, unsigned rgb32)
 }
 
 void GB::loadState(const void *data) {
+   std::lock_guard<std::mutex> machine(debugger->machine);
    SaveState state;
    p_->cpu.setStatePtrs(state);
    
    if (StateSaver::loadState(state, data)) {
       p_->cpu.loadState(state);
       p_->cpu.mem_.bootloader.choosebank(state.mem.ioamhram.get()[0x150] != 0xFF);
+      p_->restartDeltas();
    }
 }
 
 void GB::saveState(void *data) {
+   std::lock_guard<std::mutex> machine(debugger->machine);
    SaveState state;
    p_->cpu.setStatePtrs(state);
    p_->cpu.saveState(state);
    StateSaver::saveState(state, data);
+   p_->restartDeltas();
 }
 
 size_t GB::stateSize() const {
+   std::lock_guard<std::mutex> machine(debugger->machine);
    SaveState state;
    p_->cpu.setStatePtrs(state);
    p_->cpu.saveState(state);
    return StateSaver::stateSize(state);
 }
 
+bool GB::loadDeltaState(const void *data) {
+   std::lock_guard<std::mutex> machine(debugger->machine);
+   SaveState state;
+   p_->cpu.setStatePtrs(state);
+
+   if (!p_->cpu.mem_.loaded() || !StateSaver::loadState(state, data, true))
+      return false;
+
+   p_->cpu.loadState(state);
+   p_->cpu.mem_.bootloader.choosebank(state.mem.ioamhram.get()[0x150] != 0xFF);
+   p_->restartDeltas();
+   return true;
+}
+
+void GB::saveDeltaState(void *data) {
+   std::lock_guard<std::mutex> machine(debugger->machine);
+   if (!p_->cpu.mem_.loaded())
+      return;
+
+   SaveState state;
+   p_->cpu.setStatePtrs(state);
+   p_->cpu.saveState(state);
+
+   std::lock_guard<std::mutex> lock(p_->dirtyMutex);
+   p_->cpu.mem_.trackDirty();
+   p_->collectDirtyPages();
+   StateSaver::saveState(state, data, &p_->deltaPages[0]);
+   std::fill(p_->deltaPages.begin(), p_->deltaPages.end(), 0);
+}
+
+size_t GB::deltaStateSize() {
+   std::lock_guard<std::mutex> machine(debugger->machine);
+   if (!p_->cpu.mem_.loaded())
+      return 0;
+
+   SaveState state;
+   p_->cpu.setStatePtrs(state);
+   p_->cpu.saveState(state);
+
+   std::lock_guard<std::mutex> lock(p_->dirtyMutex);
+   p_->cpu.mem_.trackDirty();
+   p_->collectDirtyPages();
+   return StateSaver::stateSize(state, &p_->deltaPages[0]);
+}
+
+size_t GB::collapseDeltaStates(const void *const *deltas, size_t count, void *data) {
+   return StateSaver::collapseDeltas(deltas, count, data);
+}
+
+bool GB::setCoverage(std::size_t size, unsigned char *map) {
+	if (size & (size - 1))
+		return false;
+
+	if (size && !map) {
+		p_->ownCoverage.assign(size, 0);
+		map = &p_->ownCoverage[0];
+	} else
+		p_->ownCoverage.clear();
+
+	p_->coverage = size ? map : 0;
+	p_->coverageSize = size;
+	p_->cpu.setCoverage(p_->coverage, size);
+	return true;
+}
+
+unsigned char const * GB::coverage() const {
+	return p_->coverage;
+}
+
+std::size_t GB::coverageSize() const {
+	return p_->coverageSize;
+}
+
+void GB::clearCoverage() {
+	if (p_->coverage)
+		std::memset(p_->coverage, 0, p_->coverageSize);
+
+	p_->cpu.clearCoveragePath();
+}
+
+void GB::setIdleLoopSkip(bool enable) {
+	p_->cpu.setIdleLoopSkip(enable);
+}
+
+bool GB::setThreadedDispatch(bool enable) {
+	return p_->cpu.setThreadedDispatch(enable);
+}
+
+void GB::idleLoopStats(unsigned long long &cycles, unsigned long long &skipped) const {
+	cycles = p_->cpu.idleLoopCycles();
+	skipped = p_->cpu.idleLoopSkipped();
+}
+
+void GB::dirtyLayout(DirtyLayout &layout) const {
+	layout = DirtyLayout();
+
+	if (p_->cpu.mem_.loaded()) {
+		Memory const &mem = p_->cpu.mem_;
+		layout.sram = mem.sramPage();
+		layout.wram = mem.wramPage();
+		layout.pages = mem.dirtyPages();
+		layout.oam = layout.pages - 2;
+		layout.hram = layout.pages - 1;
+	}
+}
+
+void GB::takeDirtyPages(unsigned long long *bitmap) {
+	if (p_->cpu.mem_.loaded()) {
+		std::lock_guard<std::mutex> lock(p_->dirtyMutex);
+		p_->cpu.mem_.trackDirty();
+		p_->collectDirtyPages();
+		std::copy(p_->dirtyPages.begin(), p_->dirtyPages.end(), bitmap);
+		std::fill(p_->dirtyPages.begin(), p_->dirtyPages.end(), 0);
+	}
+}
+
+bool GB::profile(Profile &snapshot) const {
+#ifdef GAMBATTE_PROFILE
+	snapshot = p_->cpu.mem_.profile();
+	return true;
+#else
+	(void)snapshot;
+	return false;
+#endif
+}
+
+void GB::clearProfile() {
+#ifdef GAMBATTE_PROFILE
+	p_->cpu.mem_.profile() = Profile();
+#endif
+}
+
 void GB::setColorCorrection(bool enable) {
    p_->cpu.mem_.display_setColorCorrection(enable);
 }
@@ -175,14 +360,17 @@ video_pixel_t GB::gbcToRgb32(const unsigned bgr15) {
 
 
 void GB::setGameGenie(const std::string &codes) {
+ std::lock_guard<std::mutex> machine(debugger->machine);
  p_->cpu.setGameGenie(codes);
 }
 
 void GB::setGameShark(const std::string &codes) {
+ std::lock_guard<std::mutex> machine(debugger->machine);
  p_->cpu.setGameShark(codes);
 }
 
 void GB::clearCheats() {
+ std::lock_guard<std::mutex> machine(debugger->machine);
  p_->cpu.clearCheats();
 }
 
@@ -39,7 +39,7 @@ namespace gambatte
 
    static inline unsigned rombanks(MemPtrs const &memptrs)
    {
-      return (memptrs.romdataend()     - memptrs.romdata()    ) / 0x4000;
+      return memptrs.rombanks();
    }
 
    class DefaultMbc : public Mbc {
@@ -498,13 +498,6 @@ namespace gambatte
       mbc->loadState(state.mem);
    }
 
-   static void enforce8bit(unsigned char *data, unsigned long sz)
-   {
-      if (static_cast<unsigned char>(0x100))
-         while (sz--)
-            *data++ &= 0xFF;
-   }
-
    static unsigned pow2ceil(unsigned n)
    {
       --n;
@@ -610,14 +603,10 @@ namespace gambatte
 
       ggUndoList_.clear();
       mbc.reset();
-      memptrs_.reset(rombanks, rambanks, cgb ? 8 : 2);
+      memptrs_.reset(romdata, (romsize / 0x4000) * 0x4000ul, rombanks, rambanks, cgb ? 8 : 2);
       rtc_.set(false, 0);
       huc3_.set(false);
 
-      memcpy(memptrs_.romdata(), romdata, ((romsize / 0x4000) * 0x4000ul) * sizeof(unsigned char));
-      std::memset(memptrs_.romdata() + (romsize / 0x4000) * 0x4000ul, 0xFF, (rombanks - romsize / 0x4000) * 0x4000ul);
-      enforce8bit(memptrs_.romdata(), rombanks * 0x4000ul);
-
       switch (type)
       {
          case PLAIN: mbc.reset(new Mbc0(memptrs_)); break;
@@ -629,7 +618,7 @@ namespace gambatte
                         mbc.reset(new Mbc1(memptrs_));
                      break;
          case MBC2: mbc.reset(new Mbc2(memptrs_)); break;
-         case MBC3: mbc.reset(new Mbc3(memptrs_, hasRtc(memptrs_.romdata()[0x147]) ? &rtc_ : 0)); break;
+         case MBC3: mbc.reset(new Mbc3(memptrs_, hasRtc(memptrs_.rombankdata(0)[0x147]) ? &rtc_ : 0)); break;
          case MBC5: mbc.reset(new Mbc5(memptrs_)); break;
          case HUC1: mbc.reset(new HuC1(memptrs_)); break;
          case HUC3:
@@ -660,13 +649,13 @@ namespace gambatte
             cmp = ((cmp >> 2 | cmp << 6) ^ 0x45) & 0xFF;
          }
 
-         for (unsigned bank = 0; bank < static_cast<std::size_t>(memptrs_.romdataend() - memptrs_.romdata()) / 0x4000; ++bank)
+         for (unsigned bank = 0; bank < memptrs_.rombanks(); ++bank)
          {
             if (mbc->isAddressWithinAreaRombankCanBeMappedTo(addr, bank)
-                  && (cmp > 0xFF || memptrs_.romdata()[bank * 0x4000ul + (addr & 0x3FFF)] == cmp))
+                  && (cmp > 0xFF || memptrs_.rombankdata(bank)[addr & 0x3FFF] == cmp))
             {
-               ggUndoList_.push_back(AddrData(bank * 0x4000ul + (addr & 0x3FFF), memptrs_.romdata()[bank * 0x4000ul + (addr & 0x3FFF)]));
-               memptrs_.romdata()[bank * 0x4000ul + (addr & 0x3FFF)] = val;
+               ggUndoList_.push_back(AddrData(bank * 0x4000ul + (addr & 0x3FFF), memptrs_.rombankdata(bank)[addr & 0x3FFF]));
+               memptrs_.writableRombank(bank)[addr & 0x3FFF] = val;
             }
          }
       }
@@ -689,8 +678,8 @@ namespace gambatte
    {
        for (std::vector<AddrData>::reverse_iterator it = ggUndoList_.rbegin(), end = ggUndoList_.rend(); it != end; ++it)
           {
-             if (memptrs_.romdata() + it->addr < memptrs_.romdataend())
-                memptrs_.romdata()[it->addr] = it->data;
+             if (it->addr / 0x4000 < memptrs_.rombanks())
+                memptrs_.writableRombank(it->addr / 0x4000)[it->addr & 0x3FFF] = it->data;
           }
 
        ggUndoList_.clear();
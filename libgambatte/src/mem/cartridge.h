@@ -58,21 +58,67 @@ namespace gambatte
             return memptrs_.wmem(area);
          }
 
+         const unsigned char * rpage(unsigned page) const { return memptrs_.rpage(page); }
+         unsigned char * wpage(unsigned page) const { return memptrs_.wpage(page); }
+
+         void setDirty(const unsigned char *p) { memptrs_.setDirty(p); }
+         void setOamDirty() { memptrs_.setOamDirty(); }
+         void setHramDirty() { memptrs_.setHramDirty(); }
+         void setAllDirty() { memptrs_.setAllDirty(); }
+         void trackDirty() { memptrs_.trackDirty(); }
+         std::size_t dirtyPages() const { return memptrs_.dirtyPages(); }
+         void takeDirty(unsigned long long *bitmap) { memptrs_.takeDirty(bitmap); }
+
          unsigned char * vramdata() const
          {
             return memptrs_.vramdata();
          }
 
-         unsigned char * romdata(unsigned area) const 
+         const unsigned char * romdata(unsigned area) const 
          {
             return memptrs_.romdata(area);
          }
 
+         const unsigned char * rombankdata(unsigned bank) const
+         {
+            return memptrs_.rombankdata(bank);
+         }
+
+         unsigned char * writableRombank0()
+         {
+            return memptrs_.writableRombank(memptrs_.rombank0());
+         }
+
+         unsigned rombanks() const
+         {
+            return memptrs_.rombanks();
+         }
+
+         unsigned rombank() const
+         {
+            return memptrs_.rombank();
+         }
+
          unsigned char * wramdata(unsigned area) const
          {
             return memptrs_.wramdata(area);
          }
 
+         unsigned char * wramdataend() const
+         {
+            return memptrs_.wramdataend();
+         }
+
+         unsigned char * rambankdata() const
+         {
+            return memptrs_.rambankdata();
+         }
+
+         unsigned char * rambankdataend() const
+         {
+            return memptrs_.rambankdataend();
+         }
+
          const unsigned char * rdisabledRam() const
          {
             return memptrs_.rdisabledRam();
@@ -112,6 +158,21 @@ namespace gambatte
             memptrs_.setOamDmaSrc(oamDmaSrc);
          }
 
+         void setTraps(unsigned readAreas, unsigned writeAreas)
+         {
+            memptrs_.setTraps(readAreas, writeAreas);
+         }
+
+         bool isReadTrapped(unsigned area) const
+         {
+            return memptrs_.isReadTrapped(area);
+         }
+
+         bool isWriteTrapped(unsigned area) const
+         {
+            return memptrs_.isWriteTrapped(area);
+         }
+
          void mbcWrite(unsigned addr, unsigned data) { mbc->romWrite(addr, data); }
 
          bool isCgb() const
@@ -138,6 +199,7 @@ namespace gambatte
          bool isHuC3() const { return huc3_.isHuC3(); }
          unsigned char HuC3Read(unsigned p, unsigned long const cc) { return huc3_.read(p, cc); }
          void HuC3Write(unsigned p, unsigned data) { huc3_.write(p, data); }
+         void setClock(const uint64_t *clock) { rtc_.setClock(clock); huc3_.setClock(clock); }
 
          void *savedata_ptr();
          unsigned savedata_size();
@@ -45,21 +45,21 @@ namespace gambatte
    void *Cartridge::savedata_ptr()
    {
       // Check ROM header for battery.
-      if (hasBattery(memptrs_.romdata()[0x147]))
+      if (hasBattery(memptrs_.rombankdata(0)[0x147]))
          return memptrs_.rambankdata();
       return 0;
    }
 
    unsigned Cartridge::savedata_size()
    {
-      if (hasBattery(memptrs_.romdata()[0x147]))
+      if (hasBattery(memptrs_.rombankdata(0)[0x147]))
          return memptrs_.rambankdataend() - memptrs_.rambankdata();
       return 0;
    }
 
    void *Cartridge::rtcdata_ptr()
    {
-      if (hasRtc(memptrs_.romdata()[0x147])) {
+      if (hasRtc(memptrs_.rombankdata(0)[0x147])) {
          if (isHuC3()) {
             return &huc3_.getBaseTime();
          } else {
@@ -71,7 +71,7 @@ namespace gambatte
 
    unsigned Cartridge::rtcdata_size()
    { 
-      if (hasRtc(memptrs_.romdata()[0x147])) {
+      if (hasRtc(memptrs_.rombankdata(0)[0x147])) {
          if (isHuC3()) {
             return sizeof(huc3_.getBaseTime());
          } else {
@@ -38,6 +38,8 @@ public:
 	HuC3Chip();
 	uint64_t baseTime() const { return baseTime_; }
 	void setBaseTime(uint64_t baseTime) { baseTime_ = baseTime; }
+	// Reads the time from *clock instead of std::time while set.
+	void setClock(uint64_t const *clock) { clock_ = clock; }
 
 	uint64_t& getBaseTime()
 	{
@@ -59,6 +61,7 @@ public:
 private:
 	uint64_t baseTime_;
 	uint64_t haltTime_;
+	uint64_t const *clock_;
 	unsigned dataTime_;
     unsigned writingTime_;
     unsigned char ramValue_;
@@ -70,6 +73,7 @@ private:
     bool halted_;
     bool irReceivingPulse_;
 
+	uint64_t now() const { return clock_ ? *clock_ : std::time(0); }
 	void doLatch();
     void updateTime();
 };
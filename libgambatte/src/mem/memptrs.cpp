@@ -19,70 +19,205 @@
 #include "memptrs.h"
 #include <algorithm>
 #include <cstring>
+#include <mutex>
 
 namespace gambatte
 {
 
+   namespace
+   {
+      struct SharedRom
+      {
+         std::weak_ptr<const unsigned char> image;
+         std::size_t romsize;
+         unsigned rombanks;
+      };
+
+      void enforce8bit(unsigned char *data, unsigned long sz)
+      {
+         if (static_cast<unsigned char>(0x100))
+            while (sz--)
+               *data++ &= 0xFF;
+      }
+
+      // Returns the padded image of rom, reusing the one of any other
+      // instance that has the same ROM loaded.
+      std::shared_ptr<const unsigned char> sharedRomImage(const unsigned char *rom,
+            const std::size_t romsize, const unsigned rombanks)
+      {
+         static std::mutex mutex;
+         static std::vector<SharedRom> images;
+         std::lock_guard<std::mutex> lock(mutex);
+         std::shared_ptr<const unsigned char> image;
+
+         for (std::vector<SharedRom>::iterator it = images.begin(); it != images.end();)
+         {
+            if (!(image = it->image.lock()))
+            {
+               it = images.erase(it);
+               continue;
+            }
+
+            if (it->romsize == romsize && it->rombanks == rombanks
+                  && std::memcmp(image.get(), rom, romsize) == 0)
+               return image;
+
+            ++it;
+         }
+
+         unsigned char *const data = new unsigned char[rombanks * 0x4000ul];
+         std::memcpy(data, rom, romsize);
+         std::memset(data + romsize, 0xFF, rombanks * 0x4000ul - romsize);
+         enforce8bit(data, rombanks * 0x4000ul);
+         image.reset(data, std::default_delete<unsigned char[]>());
+
+         SharedRom const entry = { image, romsize, rombanks };
+         images.push_back(entry);
+         return image;
+      }
+   }
+
    MemPtrs::MemPtrs()
       : rmem_()
       , wmem_()
+      , rpages_()
+      , wpages_()
       , romdata_()
       , wramdata_()
       , vrambankptr_(0)
       , rsrambankptr_(0)
       , wsrambankptr_(0)
-      ,memchunk_(0)
+      , rombank0_(0)
+      , rombank_(1)
+      , memchunk_(0)
+      , dirty_(0)
+      , trackDirty_(false)
       , rambankdata_(0)
       , wramdataend_(0)
       , oamDmaSrc_(oam_dma_src_off)
+      , rtraps_(0)
+      , wtraps_(0)
    {
    }
 
    MemPtrs::~MemPtrs()
    {
+      freePrivateRombanks();
+      delete []dirty_;
       delete []memchunk_;
    }
 
-   void MemPtrs::reset(const unsigned rombanks, const unsigned rambanks, const unsigned wrambanks)
+   void MemPtrs::freePrivateRombanks()
+   {
+      for (std::size_t bank = 0; bank < privateRombanks_.size(); ++bank)
+         delete []privateRombanks_[bank];
+
+      privateRombanks_.clear();
+   }
+
+   void MemPtrs::reset(const unsigned char *const rom, const std::size_t romsize,
+         const unsigned rombanks, const unsigned rambanks, const unsigned wrambanks)
    {
+      freePrivateRombanks();
+      rom_ = sharedRomImage(rom, romsize, rombanks);
+      rombankdata_.resize(rombanks);
+      privateRombanks_.resize(rombanks);
+
+      for (unsigned bank = 0; bank < rombanks; ++bank)
+         rombankdata_[bank] = rom_.get() + bank * 0x4000ul;
+
       delete []memchunk_;
       memchunk_     = new unsigned char[
-         0x4000 
-         + rombanks * 0x4000ul + 0x4000
+         0x4000
          + rambanks * 0x2000ul 
          + wrambanks * 0x1000ul 
          + 0x4000];
 
-      romdata_[0]   = romdata();   
-      rambankdata_  = romdata_[0] + rombanks * 0x4000ul + 0x4000;
+      rombank0_     = 0;
+      romdata_[0]   = rombankdata_[0];
+      rambankdata_  = memchunk_ + 0x4000;
       wramdata_[0]  = rambankdata_ + rambanks * 0x2000ul;
       wramdataend_ = wramdata_[0] + wrambanks * 0x1000ul;
 
       std::memset(rdisabledRamw(), 0xFF, 0x2000);
 
+      delete []dirty_;
+      dirty_ = new std::atomic<unsigned long long>[dirtyWords()];
+      setAllDirty();
+
       oamDmaSrc_    = oam_dma_src_off;
       rmem_[0x3]    = rmem_[0x2] = rmem_[0x1] = rmem_[0x0] = romdata_[0];
       rmem_[0xC]    = wmem_[0xC] = wramdata_[0] - 0xC000;
       rmem_[0xE]    = wmem_[0xE] = wramdata_[0] - 0xE000;
 
-      setRombank(1);
+      setRombank(rombanks > 1);
       setRambank(0, 0);
       setVrambank(0);
       setWrambank(1);
    }
 
+   void MemPtrs::setAllDirty()
+   {
+      for (std::size_t word = 0; word < dirtyWords(); ++word)
+         dirty_[word].store(~0ull, std::memory_order_relaxed);
+   }
+
+   void MemPtrs::trackDirty()
+   {
+      if (trackDirty_.load(std::memory_order_relaxed))
+         return;
+
+      trackDirty_.store(true, std::memory_order_relaxed);
+      setAllDirty();
+   }
+
+   void MemPtrs::takeDirty(unsigned long long *const bitmap)
+   {
+      std::size_t const pages = dirtyPages();
+
+      for (std::size_t word = 0; word < (pages + 63) / 64; ++word)
+         bitmap[word] = dirty_[word].exchange(0, std::memory_order_relaxed);
+
+      // the wdisabledRam sink shares the tail of the last word
+      if (pages & 63)
+         bitmap[pages / 64] &= (1ull << (pages & 63)) - 1;
+   }
+
+   unsigned char * MemPtrs::writableRombank(const unsigned bank)
+   {
+      if (!privateRombanks_[bank])
+      {
+         privateRombanks_[bank] = new unsigned char[0x4000];
+         std::memcpy(privateRombanks_[bank], rombankdata_[bank], 0x4000);
+         rombankdata_[bank] = privateRombanks_[bank];
+
+         if (bank == rombank0_)
+            setRombank0(bank);
+         if (bank == rombank_)
+            setRombank(bank);
+      }
+
+      return privateRombanks_[bank];
+   }
+
    void MemPtrs::setRombank0(const unsigned bank)
    {
-      romdata_[0] = romdata() + bank * 0x4000ul;
+      rombank0_ = bank;
+      romdata_[0] = rombankdata_[bank];
       rmem_[0x3] = rmem_[0x2] = rmem_[0x1] = rmem_[0x0] = romdata_[0];
       disconnectOamDmaAreas();
+      disconnectTrappedAreas();
+      connectPages();
    }
 
    void MemPtrs::setRombank(const unsigned bank)
    {
-      romdata_[1] = romdata() + bank * 0x4000ul - 0x4000;
+      rombank_ = bank;
+      romdata_[1] = rombankdata_[bank] - 0x4000;
       rmem_[0x7] = rmem_[0x6] = rmem_[0x5] = rmem_[0x4] = romdata_[1];
       disconnectOamDmaAreas();
+      disconnectTrappedAreas();
+      connectPages();
    }
 
    void MemPtrs::setRambank(const unsigned flags, const unsigned rambank)
@@ -97,6 +232,8 @@ namespace gambatte
       rmem_[0xB] = rmem_[0xA] = rsrambankptr_;
       wmem_[0xB] = wmem_[0xA] = wsrambankptr_;
       disconnectOamDmaAreas();
+      disconnectTrappedAreas();
+      connectPages();
    }
 
    void MemPtrs::setWrambank(const unsigned bank)
@@ -104,6 +241,8 @@ namespace gambatte
       wramdata_[1] = wramdata_[0] + ((bank & 0x07) ? (bank & 0x07) : 1) * 0x1000;
       rmem_[0xD] = wmem_[0xD] = wramdata_[1] - 0xD000;
       disconnectOamDmaAreas();
+      disconnectTrappedAreas();
+      connectPages();
    }
 
    void MemPtrs::setOamDmaSrc(const OamDmaSrc oamDmaSrc)
@@ -118,6 +257,42 @@ namespace gambatte
 
       oamDmaSrc_ = oamDmaSrc;
       disconnectOamDmaAreas();
+      disconnectTrappedAreas();
+      connectPages();
+   }
+
+   void MemPtrs::setTraps(const unsigned readAreas, const unsigned writeAreas)
+   {
+      rtraps_ = readAreas;
+      wtraps_ = writeAreas;
+
+      // reconnect previously trapped areas before applying the new set
+      if (romdata_[0])
+         setOamDmaSrc(oamDmaSrc_);
+   }
+
+   void MemPtrs::disconnectTrappedAreas()
+   {
+      for (unsigned area = 0; area < 0x10; ++area)
+      {
+         if (rtraps_ >> area & 1)
+            rmem_[area] = 0;
+         if (wtraps_ >> area & 1)
+            wmem_[area] = 0;
+      }
+   }
+
+   void MemPtrs::connectPages()
+   {
+      // The echo follows area D, which maps the same WRAM bank and is
+      // disconnected whenever OAM DMA conflicts with either of them.
+      const unsigned char *const recho =
+         rmem_[0xD] && !(rtraps_ >> 0xF & 1) ? wramdata_[1] - 0xF000 : 0;
+      unsigned char *const wecho =
+         wmem_[0xD] && !(wtraps_ >> 0xF & 1) ? wramdata_[1] - 0xF000 : 0;
+
+      std::fill(rpages_ + 0xF0, rpages_ + 0xFE, recho);
+      std::fill(wpages_ + 0xF0, wpages_ + 0xFE, wecho);
    }
 
    void MemPtrs::disconnectOamDmaAreas()
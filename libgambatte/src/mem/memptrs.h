@@ -19,6 +19,11 @@
 #ifndef MEMPTRS_H
 #define MEMPTRS_H
 
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
 namespace gambatte
 {
 
@@ -41,7 +46,10 @@ namespace gambatte
 
          MemPtrs();
          ~MemPtrs();
-         void reset(unsigned rombanks, unsigned rambanks, unsigned wrambanks);
+         // ROM images are shared read-only between every MemPtrs that loads
+         // the same data; only VRAM, SRAM and WRAM are allocated per instance.
+         void reset(const unsigned char *rom, std::size_t romsize,
+               unsigned rombanks, unsigned rambanks, unsigned wrambanks);
 
          const unsigned char * rmem(unsigned area) const
          {
@@ -53,6 +61,20 @@ namespace gambatte
             return wmem_[area];
          }
 
+         // 256-byte pages that are plain memory inside an area rmem/wmem
+         // leave to the slow path, indexed by p >> 8. Only the F000-FDFF
+         // echo of WRAM qualifies: VRAM and OAM accesses have to sync the
+         // LCD, and FF00-FFFF mixes HRAM with I/O registers.
+         const unsigned char * rpage(unsigned page) const
+         {
+            return rpages_[page];
+         }
+
+         unsigned char * wpage(unsigned page) const
+         {
+            return wpages_[page];
+         }
+
          unsigned char * vramdata() const
          {
             return rambankdata_ - 0x4000;
@@ -63,19 +85,35 @@ namespace gambatte
             return rambankdata_;
          }
 
-         unsigned char * romdata() const
+         const unsigned char * romdata(unsigned area) const 
          {
-            return memchunk_ + 0x4000;
+            return romdata_[area];
          }
 
-         unsigned char * romdata(unsigned area) const 
+         const unsigned char * rombankdata(unsigned bank) const
          {
-            return romdata_[area];
+            return rombankdata_[bank];
          }
 
-         unsigned char * romdataend() const
+         // Gives the instance its own copy of a ROM bank the first time it
+         // is written to (cheats, bootloader), leaving the shared image alone.
+         unsigned char * writableRombank(unsigned bank);
+
+         unsigned rombanks() const
          {
-            return rambankdata_ - 0x4000;
+            return rombankdata_.size();
+         }
+
+         // bank currently mapped at 0x0000-0x3FFF
+         unsigned rombank0() const
+         {
+            return rombank0_;
+         }
+
+         // bank currently mapped at 0x4000-0x7FFF
+         unsigned rombank() const
+         {
+            return rombank_;
          }
 
          unsigned char * wramdata(unsigned area) const
@@ -123,6 +161,40 @@ namespace gambatte
             return oamDmaSrc_;
          }
 
+         // Dirty bitmap, one bit per 256-byte page of memchunk_: VRAM, then
+         // SRAM, then WRAM. OAM and 0xFF00-0xFFFF take the two pages after
+         // WRAM, which back the never written rdisabledRam filler. Nothing is
+         // recorded until trackDirty is first called, so that writes cost a
+         // test and a branch for frontends that never ask.
+         void setDirty(const unsigned char *p)
+         {
+            if (!trackDirty_.load(std::memory_order_relaxed))
+               return;
+
+            std::size_t const page = (p - memchunk_) >> 8;
+            std::atomic<unsigned long long> &word = dirty_[page >> 6];
+            word.store(word.load(std::memory_order_relaxed) | 1ull << (page & 63),
+                  std::memory_order_relaxed);
+         }
+
+         void setOamDirty() { setDirty(wramdataend_); }
+         void setHramDirty() { setDirty(wramdataend_ + 0x100); }
+         void setAllDirty();
+
+         // Starts recording writes, flagging every page the first time since
+         // the untracked writes before it are unknown.
+         void trackDirty();
+
+         std::size_t dirtyPages() const
+         {
+            return ((wramdataend_ - memchunk_) >> 8) + 2;
+         }
+
+         // Copies (dirtyPages() + 63) / 64 words to bitmap, clearing each
+         // with one atomic exchange. A concurrent write may be reported
+         // twice, never lost.
+         void takeDirty(unsigned long long *bitmap);
+
          void setRombank0(unsigned bank);
          void setRombank(unsigned bank);
          void setRambank(unsigned ramFlags, unsigned rambank);
@@ -130,21 +202,42 @@ namespace gambatte
          void setWrambank(unsigned bank);
          void setOamDmaSrc(OamDmaSrc oamDmaSrc);
 
+         // Areas (bit n covers n * 0x1000) whose reads/writes must take the
+         // nontrivial path so that the debugger can check its watchpoints.
+         void setTraps(unsigned readAreas, unsigned writeAreas);
+         bool isReadTrapped(unsigned area) const { return rtraps_ >> area & 1; }
+         bool isWriteTrapped(unsigned area) const { return wtraps_ >> area & 1; }
+
       private:
-         unsigned char *romdata_[2];
+         const unsigned char *romdata_[2];
          unsigned char *wramdata_[2];
          const unsigned char *rmem_[0x10];
          unsigned char *wmem_[0x10];
+         const unsigned char *rpages_[0x100];
+         unsigned char *wpages_[0x100];
          unsigned char *vrambankptr_;
          unsigned char *rsrambankptr_;
          unsigned char *wsrambankptr_;
+         std::shared_ptr<const unsigned char> rom_;
+         std::vector<const unsigned char *> rombankdata_;
+         std::vector<unsigned char *> privateRombanks_;
+         unsigned rombank0_;
+         unsigned rombank_;
          unsigned char *memchunk_;
+         std::atomic<unsigned long long> *dirty_;
+         std::atomic<bool> trackDirty_;
          unsigned char *rambankdata_;
          unsigned char *wramdataend_;
          OamDmaSrc oamDmaSrc_;
+         unsigned rtraps_;
+         unsigned wtraps_;
          MemPtrs(const MemPtrs &);
          MemPtrs & operator=(const MemPtrs &);
+         void freePrivateRombanks();
+         std::size_t dirtyWords() const { return (wramdataend_ + 0x4000 - memchunk_ + 0x3FFF) / 0x4000; }
          void disconnectOamDmaAreas();
+         void disconnectTrappedAreas();
+         void connectPages();
          unsigned char * rdisabledRamw() const { return wramdataend_ ; }
          unsigned char * wdisabledRam() const { return wramdataend_ + 0x2000; }
    };
@@ -27,6 +27,7 @@ namespace gambatte
       activeSet_(NULL),
       baseTime_(0),
       haltTime_(0),
+      clock_(NULL),
       index_(5),
       dataDh_(0),
       dataDl_(0),
@@ -40,7 +41,7 @@ namespace gambatte
 
    void Rtc::doLatch()
    {
-      uint64_t tmp = ((dataDh_ & 0x40) ? haltTime_ : std::time(0)) - baseTime_;
+      uint64_t tmp = ((dataDh_ & 0x40) ? haltTime_ : now()) - baseTime_;
 
       while (tmp > 0x1FF * 86400)
       {
@@ -123,7 +124,7 @@ namespace gambatte
 
    void Rtc::setDh(const unsigned new_dh)
    {
-      const uint64_t unixtime     = (dataDh_ & 0x40) ? haltTime_ : std::time(0);
+      const uint64_t unixtime     = (dataDh_ & 0x40) ? haltTime_ : now();
       const uint64_t old_highdays = ((unixtime - baseTime_) / 86400) & 0x100;
       baseTime_                   += old_highdays * 86400;
       baseTime_                   -= ((new_dh & 0x1) << 8) * 86400;
@@ -131,15 +132,15 @@ namespace gambatte
       if ((dataDh_ ^ new_dh) & 0x40)
       {
          if (new_dh & 0x40)
-            haltTime_ = std::time(0);
+            haltTime_ = now();
          else
-            baseTime_ += std::time(0) - haltTime_;
+            baseTime_ += now() - haltTime_;
       }
    }
 
    void Rtc::setDl(const unsigned new_lowdays)
    {
-      const uint64_t unixtime = (dataDh_ & 0x40) ? haltTime_ : std::time(0);
+      const uint64_t unixtime = (dataDh_ & 0x40) ? haltTime_ : now();
       const uint64_t old_lowdays = ((unixtime - baseTime_) / 86400) & 0xFF;
       baseTime_ += old_lowdays * 86400;
       baseTime_ -= new_lowdays * 86400;
@@ -147,7 +148,7 @@ namespace gambatte
 
    void Rtc::setH(const unsigned new_hours)
    {
-      const uint64_t unixtime = (dataDh_ & 0x40) ? haltTime_ : std::time(0);
+      const uint64_t unixtime = (dataDh_ & 0x40) ? haltTime_ : now();
       const uint64_t old_hours = ((unixtime - baseTime_) / 3600) % 24;
       baseTime_ += old_hours * 3600;
       baseTime_ -= new_hours * 3600;
@@ -155,7 +156,7 @@ namespace gambatte
 
    void Rtc::setM(const unsigned new_minutes)
    {
-      const uint64_t unixtime = (dataDh_ & 0x40) ? haltTime_ : std::time(0);
+      const uint64_t unixtime = (dataDh_ & 0x40) ? haltTime_ : now();
       const uint64_t old_minutes = ((unixtime - baseTime_) / 60) % 60;
       baseTime_ += old_minutes * 60;
       baseTime_ -= new_minutes * 60;
@@ -163,7 +164,7 @@ namespace gambatte
 
    void Rtc::setS(const unsigned new_seconds)
    {
-      const uint64_t unixtime = (dataDh_ & 0x40) ? haltTime_ : std::time(0);
+      const uint64_t unixtime = (dataDh_ & 0x40) ? haltTime_ : now();
       baseTime_ += (unixtime - baseTime_) % 60;
       baseTime_ -= new_seconds;
    }
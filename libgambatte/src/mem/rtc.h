@@ -47,6 +47,12 @@ namespace gambatte
             baseTime_ = baseTime;
          }
 
+         // Reads the time from *clock instead of std::time while set.
+         void setClock(const uint64_t *clock)
+         {
+            clock_ = clock;
+         }
+
          void latch(const unsigned data)
          {
             if (!lastLatchData_ && data == 1)
@@ -80,6 +86,7 @@ namespace gambatte
          void (Rtc::*activeSet_)(unsigned);
          uint64_t baseTime_;
          uint64_t haltTime_;
+         const uint64_t *clock_;
          unsigned char index_;
          unsigned char dataDh_;
          unsigned char dataDl_;
@@ -89,6 +96,11 @@ namespace gambatte
          bool enabled_;
          bool lastLatchData_;
 
+         uint64_t now() const
+         {
+            return clock_ ? *clock_ : std::time(0);
+         }
+
          void doLatch();
          void doSwapActive();
          void setDh(unsigned new_dh);
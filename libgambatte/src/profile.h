@@ -0,0 +1,64 @@
+//
+//   This program is free software; you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License version 2 as
+//   published by the Free Software Foundation.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License version 2 for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   version 2 along with this program; if not, write to the
+//   Free Software Foundation, Inc.,
+//   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "gambatte.h"
+
+// Profiling counters (see gambatte::Profile) are only compiled in with
+// GAMBATTE_PROFILE; otherwise PROFILE() and PROFILE_TIME() expand to nothing.
+#ifdef GAMBATTE_PROFILE
+
+#include <chrono>
+
+namespace gambatte {
+
+// Adds the host time until the end of the enclosing scope to a counter.
+class ProfileTimer {
+public:
+	explicit ProfileTimer(unsigned long long &ns)
+	: ns_(ns)
+	, start_(std::chrono::steady_clock::now())
+	{
+	}
+
+	~ProfileTimer() {
+		ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start_).count();
+	}
+
+private:
+	unsigned long long &ns_;
+	std::chrono::steady_clock::time_point const start_;
+
+	ProfileTimer(ProfileTimer const &);
+	ProfileTimer & operator=(ProfileTimer const &);
+};
+
+}
+
+#define PROFILE(statement) do { statement; } while (0)
+#define PROFILE_TIME(counter) ProfileTimer const profileTimer(counter)
+
+#else
+
+#define PROFILE(statement) do {} while (0)
+#define PROFILE_TIME(counter) do {} while (0)
+
+#endif
+
+#endif
@@ -18,6 +18,7 @@
  ***************************************************************************/
 #include "sound.h"
 #include "savestate.h"
+#include "profile.h"
 #include <cstring>
 #include <algorithm>
 
@@ -106,6 +107,7 @@ namespace gambatte
 
    void PSG::generateSamples(unsigned long const cycleCounter, bool const doubleSpeed)
    {
+      PROFILE_TIME(*profileNs_);
       unsigned long const cycles = (cycleCounter - lastUpdate_) >> (1 + doubleSpeed);
       lastUpdate_ += cycles << (1 + doubleSpeed);
 
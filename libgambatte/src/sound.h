@@ -74,6 +74,10 @@ public:
 	void mapSo(unsigned nr51);
 	unsigned getStatus() const;
 
+#ifdef GAMBATTE_PROFILE
+	void setProfileCounter(unsigned long long *ns) { profileNs_ = ns; }
+#endif
+
 private:
 	Channel1 ch1_;
 	Channel2 ch2_;
@@ -85,6 +89,9 @@ private:
 	unsigned long soVol_;
 	uint_least32_t rsum_;
 	bool enabled_;
+#ifdef GAMBATTE_PROFILE
+	unsigned long long *profileNs_;
+#endif
 
 	void accumulateChannels(unsigned long cycles);
 };
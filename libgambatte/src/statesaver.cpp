@@ -18,7 +18,6 @@
  ***************************************************************************/
 #include "statesaver.h"
 #include "savestate.h"
-#include "gambatte-array.h"
 #include <stdint.h>
 #include <vector>
 #include <cstring>
@@ -27,7 +26,8 @@
 class omemstream
 {
    public:
-      omemstream(void *data) : wr_ptr(static_cast<uint8_t*>(data)), has_written(0) {}
+      omemstream(void *data, const unsigned long long *dirty = 0)
+         : wr_ptr(static_cast<uint8_t*>(data)), has_written(0), dirty_(dirty) {}
 
       void put(uint8_t data)
       {
@@ -51,15 +51,20 @@ class omemstream
       bool fail() const { return false; }
       bool good() const { return true; }
 
+      // dirty page bitmap when writing a delta, null for a full state
+      const unsigned long long * dirty() const { return dirty_; }
+
    private:
       uint8_t *wr_ptr;
       size_t has_written;
+      const unsigned long long *dirty_;
 };
 
 class imemstream
 {
    public:
-      imemstream(const void *data) : rd_ptr(static_cast<const uint8_t*>(data)), has_read(0) {}
+      imemstream(const void *data, bool delta = false)
+         : rd_ptr(static_cast<const uint8_t*>(data)), has_read(0), delta_(delta) {}
 
       uint8_t get()
       {
@@ -97,10 +102,13 @@ class imemstream
 
       bool fail() const { return false; }
       bool good() const { return true; }
+      bool delta() const { return delta_; }
+      const uint8_t * pos() const { return rd_ptr; }
 
    private:
       const uint8_t *rd_ptr;
       size_t has_read;
+      bool delta_;
 };
 
 
@@ -124,6 +132,7 @@ struct Saver {
 	void (*save)(omemstream &file, const SaveState &state);
 	void (*load)(imemstream &file, SaveState &state);
 	unsigned char labelsize;
+	bool paged;
 };
 
 static inline bool operator<(const Saver &l, const Saver &r) {
@@ -252,6 +261,63 @@ static void read(imemstream &file, bool *data, unsigned long sz) {
 	file.ignore(size - sz);
 }
 
+// Deltas hold only the dirty 256-byte pages of VRAM, SRAM and WRAM,
+// each as a 16-bit page number followed by its data.
+enum { PAGE_RECORD_SIZE = 2 + 0x100 };
+
+static inline bool isDirty(const unsigned long long *dirty, unsigned long page) {
+	return dirty[page >> 6] >> (page & 63) & 1;
+}
+
+static void putPage(omemstream &file, unsigned long page, const unsigned char *data) {
+	file.put(page >> 8 & 0xFF);
+	file.put(page & 0xFF);
+	file.write(reinterpret_cast<const char*>(data), 0x100);
+}
+
+static void writePages(omemstream &file, const unsigned char *data, const unsigned long sz,
+		const unsigned long firstPage) {
+	const unsigned long long *const dirty = file.dirty();
+	
+	if (!dirty) {
+		write(file, data, sz);
+		return;
+	}
+	
+	unsigned long records = 0;
+	
+	for (unsigned long page = 0; page < sz >> 8; ++page)
+		records += isDirty(dirty, firstPage + page);
+	
+	put24(file, records * PAGE_RECORD_SIZE);
+	
+	for (unsigned long page = 0; page < sz >> 8; ++page) {
+		if (isDirty(dirty, firstPage + page))
+			putPage(file, page, data + page * 0x100);
+	}
+}
+
+static void readPages(imemstream &file, unsigned char *data, const unsigned long sz) {
+	if (!file.delta()) {
+		read(file, data, sz);
+		return;
+	}
+	
+	unsigned long size = get24(file);
+	
+	for (; size >= PAGE_RECORD_SIZE; size -= PAGE_RECORD_SIZE) {
+		unsigned long page = file.get() & 0xFF;
+		page = page << 8 | (file.get() & 0xFF);
+		
+		if (page < sz >> 8)
+			file.read(data + page * 0x100, 0x100);
+		else
+			file.ignore(0x100);
+	}
+	
+	file.ignore(size);
+}
+
 } // anon namespace
 
 namespace gambatte {
@@ -274,8 +340,8 @@ public:
 
 static void pushSaver(SaverList::list_t &list, const char *label,
 		void (*save)(omemstream &file, const SaveState &state),
-		void (*load)(imemstream &file, SaveState &state), unsigned labelsize) {
-    const Saver saver = { label, save, load, static_cast<unsigned char>(labelsize) };
+		void (*load)(imemstream &file, SaveState &state), unsigned labelsize, bool paged = false) {
+    const Saver saver = { label, save, load, static_cast<unsigned char>(labelsize), paged };
 	list.push_back(saver);
 }
 
@@ -298,6 +364,15 @@ SaverList::SaverList() {
 	pushSaver(list, label, Func::save, Func::load, sizeof label); \
 } while (0)
 
+#define ADDPAGED(arg, firstPage) do { \
+	struct Func { \
+		static void save(omemstream &file, const SaveState &state) { writePages(file, state.arg.get(), state.arg.size(), firstPage); } \
+		static void load(imemstream &file, SaveState &state) { readPages(file, state.arg.ptr, state.arg.size()); } \
+	}; \
+	\
+	pushSaver(list, label, Func::save, Func::load, sizeof label, true); \
+} while (0)
+
 #define ADDARRAY(arg) do { \
 	struct Func { \
 		static void save(omemstream &file, const SaveState &state) { write(file, state.arg, sizeof(state.arg)); } \
@@ -320,9 +395,10 @@ SaverList::SaverList() {
 	{ static const char label[] = { l,             NUL }; ADD(cpu.l); }
 	{ static const char label[] = { s,k,i,p,       NUL }; ADD(cpu.skip); }
 	{ static const char label[] = { h,a,l,t,       NUL }; ADD(mem.halted); }
-	{ static const char label[] = { v,r,a,m,       NUL }; ADDPTR(mem.vram); }
-	{ static const char label[] = { s,r,a,m,       NUL }; ADDPTR(mem.sram); }
-	{ static const char label[] = { w,r,a,m,       NUL }; ADDPTR(mem.wram); }
+	// page numbers follow the dirty bitmap, which lays these out back to back
+	{ static const char label[] = { v,r,a,m,       NUL }; ADDPAGED(mem.vram, 0); }
+	{ static const char label[] = { s,r,a,m,       NUL }; ADDPAGED(mem.sram, state.mem.vram.size() >> 8); }
+	{ static const char label[] = { w,r,a,m,       NUL }; ADDPAGED(mem.wram, (state.mem.vram.size() + state.mem.sram.size()) >> 8); }
 	{ static const char label[] = { h,r,a,m,       NUL }; ADDPTR(mem.ioamhram); }
 	{ static const char label[] = { l,d,i,v,u,p,   NUL }; ADD(mem.divLastUpdate); }
 	{ static const char label[] = { l,t,i,m,a,u,p, NUL }; ADD(mem.timaLastUpdate); }
@@ -440,6 +516,7 @@ SaverList::SaverList() {
 	
 #undef ADD
 #undef ADDPTR
+#undef ADDPAGED
 #undef ADDARRAY
 
 	list.resize(list.size());
@@ -467,13 +544,16 @@ static SaverList list;
 
 namespace gambatte {
 
-void StateSaver::saveState(const SaveState &state, void *data) {
-   omemstream file(data);
+void StateSaver::saveState(const SaveState &state, void *data, const unsigned long long *dirty) {
+   omemstream file(data, dirty);
 	
 	if (file.fail())
 		return;
 	
-	{ static const char ver[] = { 0, 1 }; file.write(ver, sizeof(ver)); }
+	{
+		static const char ver[] = { 0, 1 }, deltaVer[] = { 1, 0 };
+		file.write(dirty ? deltaVer : ver, sizeof(ver));
+	}
 	
 	writeSnapShot(file);
 	
@@ -483,17 +563,19 @@ void StateSaver::saveState(const SaveState &state, void *data) {
 	}
 }
 
-bool StateSaver::loadState(SaveState &state, const void *data) {
-   imemstream file(data);
+bool StateSaver::loadState(SaveState &state, const void *data, const bool delta) {
+   imemstream file(data, delta);
 
-   if (file.fail() || file.get() != 0)
+   if (file.fail() || file.get() != delta)
       return false;
 
    file.ignore();
    file.ignore(get24(file));
 
-   const Array<char> labelbuf(list.maxLabelsize());
-    const Saver labelbufSaver = { labelbuf, 0, 0, static_cast<unsigned char>(list.maxLabelsize()) };
+   // Label sizes fit in an unsigned char; a fixed buffer keeps loading
+   // free of allocations.
+   char labelbuf[0x100];
+    const Saver labelbufSaver = { labelbuf, 0, 0, static_cast<unsigned char>(list.maxLabelsize()), false };
 
    SaverList::const_iterator done = list.begin();
 
@@ -521,8 +603,8 @@ bool StateSaver::loadState(SaveState &state, const void *data) {
    return true;
 }
 
-size_t StateSaver::stateSize(const SaveState &state) {
-   omemstream file(0);
+size_t StateSaver::stateSize(const SaveState &state, const unsigned long long *dirty) {
+   omemstream file(0, dirty);
 
    if (file.fail())
       return 0;
@@ -539,5 +621,80 @@ size_t StateSaver::stateSize(const SaveState &state) {
    return file.size();
 }
 
+size_t StateSaver::collapseDeltas(const void *const *deltas, const size_t count, void *data) {
+   std::vector<imemstream> files;
+   char labelbuf[0x100];
+
+   for (size_t i = 0; i < count; ++i) {
+      files.push_back(imemstream(deltas[i], true));
+
+      if (files.back().get() != 1)
+         return 0;
+
+      files.back().ignore();
+      files.back().ignore(get24(files.back()));
+   }
+
+   omemstream file(data);
+
+   if (count == 0 || file.fail())
+      return 0;
+
+   { static const char ver[] = { 1, 0 }; file.write(ver, sizeof(ver)); }
+
+   writeSnapShot(file);
+
+   // Every delta holds every label in list order, so the records line up.
+   // Later deltas win: scalars come from the last one, pages from the
+   // last one that has them.
+   std::vector<const uint8_t *> pages;
+
+   for (SaverList::const_iterator it = list.begin(); it != list.end(); ++it) {
+      const uint8_t *record = 0;
+      unsigned long recordsize = 0;
+
+      pages.clear();
+
+      for (size_t i = 0; i < count; ++i) {
+         files[i].getline(labelbuf, list.maxLabelsize(), NUL);
+
+         if (std::strcmp(labelbuf, it->label))
+            return 0;
+
+         recordsize = get24(files[i]);
+         record = files[i].pos();
+
+         if (it->paged) {
+            for (unsigned long pos = 0; pos + PAGE_RECORD_SIZE <= recordsize; pos += PAGE_RECORD_SIZE) {
+               const unsigned long page = record[pos] << 8 | record[pos + 1];
+
+               if (page >= pages.size())
+                  pages.resize(page + 1);
+
+               pages[page] = record + pos + 2;
+            }
+         }
+
+         files[i].ignore(recordsize);
+      }
+
+      file.write(it->label, it->labelsize);
+
+      if (it->paged) {
+         put24(file, (pages.size() - std::count(pages.begin(), pages.end(),
+               static_cast<const uint8_t *>(0))) * PAGE_RECORD_SIZE);
+
+         for (unsigned long page = 0; page < pages.size(); ++page) {
+            if (pages[page])
+               putPage(file, page, pages[page]);
+         }
+      } else {
+         put24(file, recordsize);
+         file.write(record, recordsize);
+      }
+   }
+
+   return file.size();
 }
 
+}
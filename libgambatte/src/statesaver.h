@@ -36,9 +36,16 @@ public:
 	enum { SS_WIDTH = 160 >> SS_SHIFT };
 	enum { SS_HEIGHT = 144 >> SS_SHIFT };
 	
-   static void saveState(const SaveState &state, void *data);
-   static bool loadState(SaveState &state, const void *data);
-   static size_t stateSize(const SaveState &state);
+   // With a dirty page bitmap these write a delta, which holds only the
+   // flagged pages of VRAM, SRAM and WRAM, and loadState with delta set
+   // applies one on top of the state it was taken from.
+   static void saveState(const SaveState &state, void *data, const unsigned long long *dirty = 0);
+   static bool loadState(SaveState &state, const void *data, bool delta = false);
+   static size_t stateSize(const SaveState &state, const unsigned long long *dirty = 0);
+
+   // Merges a chain of deltas, oldest first, into one equivalent delta.
+   // Returns its size, 0 if the chain is invalid; data may be null.
+   static size_t collapseDeltas(const void *const *deltas, size_t count, void *data);
 };
 
 }
@@ -18,6 +18,7 @@
  ***************************************************************************/
 #include "video.h"
 #include "savestate.h"
+#include "profile.h"
 #include <cstring>
 #include <algorithm>
 #include <string>
@@ -87,6 +88,8 @@ void LCD::saveState(SaveState &state) const
    
    if (isCgb())
       std::memcpy(state.ppu.dmgPalette, dmgColorsGBC_, 8 * 3);
+   else
+      std::memset(state.ppu.dmgPalette, 0, 8 * 3); // unused, but saved
    
 
    lycIrq_.saveState(state);
@@ -746,6 +749,8 @@ inline void LCD::event()
 
 void LCD::update(const unsigned long cycleCounter)
 {
+   PROFILE_TIME(*profileNs_);
+
    if (!(ppu_.lcdc() & 0x80))
       return;
 
@@ -158,6 +158,10 @@ class LCD
       void setColorCorrectionBrightness(float colorCorrectionBrightness);
       void setDarkFilterLevel(unsigned darkFilterLevel);
       video_pixel_t gbcToRgb32(const unsigned bgr15);
+
+#ifdef GAMBATTE_PROFILE
+      void setProfileCounter(unsigned long long *ns) { profileNs_ = ns; }
+#endif
    private:
       enum Event { MEM_EVENT, LY_COUNT }; enum { NUM_EVENTS = LY_COUNT + 1 };
       enum MemEvent { ONESHOT_LCDSTATIRQ, ONESHOT_UPDATEWY2, MODE1_IRQ, LYC_IRQ, SPRITE_MAP,
@@ -210,6 +214,9 @@ class LCD
       unsigned char statReg_;
       unsigned char m2IrqStatReg_;
       unsigned char m1IrqStatReg_;
+#ifdef GAMBATTE_PROFILE
+      unsigned long long *profileNs_;
+#endif
 
       static void setDmgPalette(video_pixel_t *palette, const video_pixel_t *dmgColors, unsigned data);
       void setDmgPaletteColor(unsigned index, video_pixel_t rgb32);